@@ -0,0 +1,2029 @@
+/*
+
+The definitions of the expression search engines declared in exprcore.h, part
+of the exprsearch library.
+
+Author: Willem Hengeveld <itsme@xs4all.nl>
+*/
+#include "exprcore.h"
+#ifndef _WIN32
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+namespace findexpr {
+
+Tracer tracer;
+
+thread_local TraceBuffer *tracebuf = nullptr;
+
+void tracethread(const std::string& name)
+{
+    if (!tracer.enabled)
+        return;
+    if (tracebuf)
+        tracebuf->threadname = name;
+    else
+        tracebuf = tracer.newbuffer(name);
+}
+
+const char *memsubsystemnames[MEM_NSUBSYSTEMS] = { "trees", "value sets", "hash tables", "output buffers" };
+
+MemAccount memaccount;
+
+std::vector<Operation> oplist{
+    { "add", "+",   2, 1, [](T a, T b){ return a+b; } },
+    { "sub", "-",   2, 1, [](T a, T b){ return a-b; } },
+    { "mul", "*",   2, 2, [](T a, T b){ return a*b; } },
+    { "div", "/",   2, 3, [](T a, T b){ return a/b; } },
+    { "pow", "^",   2, 4, [](T a, T b){ return pow(a,b); } },
+    { "cat", "||",  2, 5, [](T a, T b){ return a*tenfactor(b)+b; } },
+
+    // NOTE: unary ops not yet supported.
+    { "neg", "-",   1, 2, [](std::vector<T> args){ return -args[0]; } },
+    { "sqrt", "√",  1, 2, [](std::vector<T> args){ return sqrt(args[0]); } },
+};
+
+Node::ptr clonetree(const Node::ptr& t)
+{
+    auto e = std::dynamic_pointer_cast<Expr>(t);
+    if (!e) {
+        auto v = Value::make();
+        v->value = t->eval();
+        return v;
+    }
+    auto c = e->args.size()==2 ? Expr::make(clonetree(e->args[0]), clonetree(e->args[1])) : Expr::make(clonetree(e->args[0]));
+    c->op = e->op;
+    return c;
+}
+
+void collectterms(const Node::ptr& t, const std::string& plus, const std::string& minus, bool negative, std::vector<std::string>& terms)
+{
+    auto op = t->operation();
+    if (op && (op->name == plus || op->name == minus)) {
+        auto e = static_cast<const Expr*>(t.get());
+        collectterms(e->args[0], plus, minus, negative, terms);
+        collectterms(e->args[1], plus, minus, negative != (op->name == minus), terms);
+        return;
+    }
+    terms.push_back((negative ? "-" : "+") + canonical(t));
+}
+
+std::string canonical(const Node::ptr& t)
+{
+    auto op = t->operation();
+    if (!op) {
+        std::ostringstream os;
+        os << t;
+        return os.str();
+    }
+    std::string name = op->name;
+    std::vector<std::string> terms;
+    if (name == "add" || name == "sub") {
+        name = "sum";
+        collectterms(t, "add", "sub", false, terms);
+        std::sort(terms.begin(), terms.end());
+    }
+    else if (name == "mul" || name == "div") {
+        name = "product";
+        collectterms(t, "mul", "div", false, terms);
+        std::sort(terms.begin(), terms.end());
+    }
+    else {
+        for (auto& arg : static_cast<const Expr*>(t.get())->args)
+            terms.push_back(canonical(arg));
+    }
+    std::string c = name + "(";
+    for (int k = 0 ; k < terms.size() ; k++) {
+        if (k)
+            c += ',';
+        c += terms[k];
+    }
+    return c + ")";
+}
+
+Generator<Node::ptr> treeshapes(int nleaves)
+{
+    if (nleaves<1)
+        co_return;
+    if (nleaves==1) {
+        co_yield Value::make();
+        co_return;
+    }
+
+    for (int i=1 ; i<nleaves ; i++)
+        for (auto t : treeshapes(nleaves-i))
+            for (auto s : treeshapes(i))
+                co_yield Expr::make(t, s);
+}
+
+Generator<Operation*> opsgenerator(const std::vector<Operation*>& ops, uint64_t i)
+{
+    for (;;) {
+        co_yield ops[i % ops.size()];
+        i /= ops.size();
+    }
+}
+
+Generator<OpAssignment> opassignments(const std::vector<Operation*>& binops, int nslots, uint64_t first, uint64_t last, std::vector<bool> isold)
+{
+    int n = binops.size();
+    bool widening = !isold.empty();
+    std::vector<int> digits(nslots);
+    std::vector<uint8_t> isnew(n);
+    for (int k = 0 ; k < n && widening ; k++)
+        isnew[k] = !isold[k];
+    int nnew = 0;      // -w: the nr of slots with a new operation
+    OpAssignment a{ first, std::vector<Operation*>(nslots) };
+    auto decode = [&]() {
+        uint64_t cur = a.index;
+        nnew = 0;
+        for (int k = 0 ; k < nslots ; k++) {
+            digits[k] = cur % n;
+            cur /= n;
+            a.ops[k] = binops[digits[k]];
+            nnew += isnew[digits[k]];
+        }
+    };
+    decode();
+    while (a.index < last) {
+        // -w: jump over the ranges of old only assignments
+        if (widening && nnew == 0) {
+            a.index = nextnewassignment(isold, nslots, a.index);
+            if (a.index >= last)
+                break;
+            decode();
+        }
+        co_yield a;
+        a.index++;
+        for (int k = 0 ; k < nslots ; k++) {
+            nnew -= isnew[digits[k]];
+            bool carry = ++digits[k] == n;
+            if (carry)
+                digits[k] = 0;
+            a.ops[k] = binops[digits[k]];
+            nnew += isnew[digits[k]];
+            if (!carry)
+                break;
+        }
+    }
+}
+
+Operation *findbinop(const std::string& name)
+{
+    for (auto& op : oplist)
+        if (op.n==2 && (op.name==name || op.infix==name))
+            return &op;
+    return nullptr;
+}
+
+bool parseops(const std::string& spec, std::vector<Operation*>& ops)
+{
+    for (auto s : stringsplitter<std::string>(spec, ",")) {
+        auto op = findbinop(s);
+        if (!op) {
+            std::cerr << "unknown operation: " << s << "\n";
+            return false;
+        }
+        ops.push_back(op);
+    }
+    return true;
+}
+
+std::string formatduration(double sec)
+{
+    char buf[64];
+    if (sec < 60)
+        snprintf(buf, sizeof(buf), "%.2f sec", sec);
+    else
+        snprintf(buf, sizeof(buf), "%.0f sec ( %dh%02dm )", sec, int(sec/3600), int(sec/60)%60);
+    return buf;
+}
+
+AsyncWriter::AsyncWriter(int fd, int depth, size_t buffersize)
+    : fd(fd), buffersize(buffersize), depth(depth)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && !(fcntl(fd, F_GETFL) & O_APPEND))
+        offset = lseek(fd, 0, SEEK_CUR);
+#endif
+    if (offset < 0)
+        this->depth = depth = 1;
+    for (int b = 0 ; b < depth ; b++) {
+        buffers.push_back(static_cast<char*>(::operator new(buffersize, std::align_val_t(4096))));
+        freebuffers.push_back(depth-1-b);
+    }
+    fill.resize(depth);
+    offsets.resize(depth);
+    memaccount.add(MEM_OUTPUT, depth*buffersize);
+#ifdef HAVE_IO_URING
+    setupring();
+#endif
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    finish();
+#ifdef HAVE_IO_URING
+    if (ringfd >= 0)
+        closering(-1);
+#endif
+    for (auto b : buffers)
+        ::operator delete(b, std::align_val_t(4096));
+    memaccount.add(MEM_OUTPUT, -int64_t(depth*buffersize));
+}
+
+#ifdef HAVE_IO_URING
+void AsyncWriter::setupring()
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringfd = syscall(__NR_io_uring_setup, depth, &p);
+    if (ringfd < 0)
+        return;
+    sqmapsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    cqmapsize = p.cq_off.cqes + p.cq_entries*sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sqmapsize = cqmapsize = std::max(sqmapsize, cqmapsize);
+    sqmap = mmap(nullptr, sqmapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    cqmap = (p.features & IORING_FEAT_SINGLE_MMAP) ? sqmap
+          : mmap(nullptr, cqmapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+    sqesize = p.sq_entries*sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ringfd, IORING_OFF_SQES));
+    if (sqmap == MAP_FAILED || cqmap == MAP_FAILED || sqes == MAP_FAILED) {
+        // undo the maps which did succeed
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesize);
+        if (cqmap != MAP_FAILED && cqmap != sqmap)
+            munmap(cqmap, cqmapsize);
+        if (sqmap != MAP_FAILED)
+            munmap(sqmap, sqmapsize);
+        sqmap = cqmap = nullptr;
+        sqes = nullptr;
+        close(ringfd);
+        ringfd = -1;
+        return;
+    }
+    auto sq = static_cast<char*>(sqmap);
+    auto cq = static_cast<char*>(cqmap);
+    sqhead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqtail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqmask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqarray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cqhead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqtail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqmask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    // registered buffers save mapping the pages for each write, this can fail on the locked memory limit
+    std::vector<iovec> iov(depth);
+    for (int b = 0 ; b < depth ; b++)
+        iov[b] = iovec{ buffers[b], buffersize };
+    fixed = syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_BUFFERS, iov.data(), depth) == 0;
+    backend = fixed ? "io_uring, registered buffers" : "io_uring";
+}
+
+void AsyncWriter::submitring(int b)
+{
+    unsigned tail = std::atomic_ref<unsigned>(*sqtail).load(std::memory_order_relaxed);
+    unsigned idx = tail & *sqmask;
+    auto& sqe = sqes[idx];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffers[b]);
+    sqe.len = fill[b];
+    sqe.off = offsets[b];
+    sqe.buf_index = fixed ? b : 0;
+    sqe.user_data = b;
+    sqarray[idx] = idx;
+    std::atomic_ref<unsigned>(*sqtail).store(tail+1, std::memory_order_release);
+    if (syscall(__NR_io_uring_enter, ringfd, 1, 0, 0, nullptr, 0) < 0) {
+        // the write was not taken: give up on io_uring, the rest goes through write(2)
+        std::atomic_ref<unsigned>(*sqtail).store(tail, std::memory_order_release);
+        closering(b);
+        backend = "io_uring failed, write(2)";
+        writeall(b, 0);
+        return;
+    }
+    inflight++;
+}
+
+void AsyncWriter::closering(int except)
+{
+    while (inflight && reap(true))
+        ;
+    if (inflight) {
+        for (int b = 0 ; b < depth ; b++)
+            if (b != except && b != cur && std::find(freebuffers.begin(), freebuffers.end(), b) == freebuffers.end())
+                writeall(b, 0);
+        inflight = 0;
+    }
+    munmap(sqes, sqesize);
+    if (cqmap != sqmap)
+        munmap(cqmap, cqmapsize);
+    munmap(sqmap, sqmapsize);
+    close(ringfd);
+    ringfd = -1;
+}
+
+bool AsyncWriter::reap(bool wait)
+{
+    if (wait && syscall(__NR_io_uring_enter, ringfd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+        return false;
+    unsigned head = std::atomic_ref<unsigned>(*cqhead).load(std::memory_order_relaxed);
+    unsigned tail = std::atomic_ref<unsigned>(*cqtail).load(std::memory_order_acquire);
+    for ( ; head != tail ; head++) {
+        auto& cqe = cqes[head & *cqmask];
+        int b = cqe.user_data;
+        inflight--;
+        // short or failed writes: write the rest synchronously
+        if (cqe.res < int64_t(fill[b]))
+            writeall(b, std::max(0, cqe.res));
+        else
+            freebuffers.push_back(b);
+    }
+    std::atomic_ref<unsigned>(*cqhead).store(head, std::memory_order_release);
+    return true;
+}
+#endif
+
+void AsyncWriter::writeall(int b, size_t done)
+{
+    while (done < fill[b]) {
+#ifndef _WIN32
+        ssize_t n = offsets[b] >= 0 ? pwrite(fd, buffers[b] + done, fill[b] - done, offsets[b] + done)
+                                    : ::write(fd, buffers[b] + done, fill[b] - done);
+#else
+        ssize_t n = fwrite(buffers[b] + done, 1, fill[b] - done, stdout);
+#endif
+        if (n <= 0) {
+            perror("write");
+            break;
+        }
+        done += n;
+    }
+    freebuffers.push_back(b);
+}
+
+void AsyncWriter::submit(int b)
+{
+    offsets[b] = offset;
+    if (offset >= 0)
+        offset += fill[b];
+    bytes += fill[b];
+    writes++;
+#ifdef HAVE_IO_URING
+    if (ringfd >= 0) {
+        submitring(b);
+        depthsum += inflight;
+        maxdepth = std::max(maxdepth, inflight);
+        if (ringfd >= 0)
+            reap(false);
+        return;
+    }
+#endif
+    depthsum++;
+    maxdepth = 1;
+    timer twait;
+    writeall(b, 0);
+    waitusec += twait.elapsed();
+}
+
+int AsyncWriter::getbuffer()
+{
+#ifdef HAVE_IO_URING
+    if (freebuffers.empty() && ringfd >= 0) {
+        timer twait;
+        while (freebuffers.empty() && ringfd >= 0)
+            if (!reap(true))
+                closering(-1);
+        waitusec += twait.elapsed();
+    }
+#endif
+    int b = freebuffers.back();
+    freebuffers.pop_back();
+    fill[b] = 0;
+    return b;
+}
+
+void AsyncWriter::finish()
+{
+    if (cur >= 0 && fill[cur])
+        submit(cur);
+    else if (cur >= 0)
+        freebuffers.push_back(cur);
+    cur = -1;
+#ifdef HAVE_IO_URING
+    while (ringfd >= 0 && inflight)
+        if (!reap(true))
+            closering(-1);
+#endif
+#ifndef _WIN32
+    // later output through std::cout continues after ours
+    if (offset >= 0)
+        lseek(fd, offset, SEEK_SET);
+#endif
+}
+
+std::string AsyncWriter::report()
+{
+    char buf[256];
+    double sec = t.elapsed() / 1e6;
+    snprintf(buf, sizeof(buf), "output: %s, %llu bytes in %llu writes, %.1f MB/s over %.2f sec, queue depth avg %.1f max %d of %d, waited %.3f sec",
+            backend, (unsigned long long)bytes, (unsigned long long)writes, sec ? bytes / sec / 1e6 : 0.0, sec,
+            writes ? double(depthsum) / writes : 0.0, maxdepth, depth, waitusec / 1e6);
+    return buf;
+}
+
+DistinctValues::DistinctValues(int nworkers, bool withexpr, size_t memory, const std::string& tmpdir)
+    : withexpr(withexpr), limit(std::max(size_t(1)<<20, memory / nworkers)), tmpdir(tmpdir), buffers(nworkers)
+{
+}
+
+DistinctValues::~DistinctValues()
+{
+    for (auto f : runs)
+        fclose(f);
+}
+
+void DistinctValues::add(int w, T value, const Node::ptr& expr)
+{
+    if (std::isnan(value))
+        return;
+    // -0 and 0 are equal, print 0 for both, whichever is kept
+    if (value == 0)
+        value = 0;
+    auto& b = buffers[w];
+    Item item{ value, std::string() };
+    if (withexpr) {
+        std::ostringstream os;
+        os << expr;
+        item.expr = os.str();
+    }
+    b.bytes += itembytes(item);
+    b.items.push_back(std::move(item));
+    if (b.bytes > limit) {
+        compact(b);
+        if (b.bytes > limit/2)
+            spill(b);
+    }
+}
+
+void DistinctValues::compact(Buffer& b)
+{
+    TraceSpan span("sort", "items", b.items.size());
+    std::sort(b.items.begin(), b.items.end());
+    auto end = std::unique(b.items.begin(), b.items.end(), [](const Item& a, const Item& b) { return a.value == b.value; });
+    b.items.erase(end, b.items.end());
+    b.bytes = 0;
+    for (auto& item : b.items)
+        b.bytes += itembytes(item);
+}
+
+FILE *DistinctValues::createrun()
+{
+#ifndef _WIN32
+    std::string path = tmpdir + "/findexpr-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0)
+        return nullptr;
+    unlink(path.c_str());    // the file is removed when it is closed
+    return fdopen(fd, "w+b");
+#else
+    return tmpfile();
+#endif
+}
+
+void DistinctValues::spill(Buffer& b)
+{
+    TraceSpan span("spill", "items", b.items.size());
+    FILE *f = createrun();
+    if (!f)
+        throw std::runtime_error("can not create a run file in " + tmpdir);
+    for (auto& item : b.items) {
+        uint32_t len = item.expr.size();
+        fwrite(&item.value, sizeof(T), 1, f);
+        fwrite(&len, sizeof(len), 1, f);
+        fwrite(item.expr.data(), 1, len, f);
+    }
+    if (fflush(f) != 0) {
+        fclose(f);
+        throw std::runtime_error("writing a run file in " + tmpdir + " failed");
+    }
+    rewind(f);
+    {
+        std::lock_guard<std::mutex> lock(m);
+        runs.push_back(f);
+        spilled += b.items.size();
+    }
+    b.items.clear();
+    b.items.shrink_to_fit();
+    b.bytes = 0;
+}
+
+bool DistinctValues::readitem(FILE *f, Item& item)
+{
+    uint32_t len;
+    if (fread(&item.value, sizeof(T), 1, f) != 1 || fread(&len, sizeof(len), 1, f) != 1)
+        return false;
+    item.expr.resize(len);
+    return len == 0 || fread(&item.expr[0], 1, len, f) == len;
+}
+
+void DistinctValues::finish(int w)
+{
+    compact(buffers[w]);
+}
+
+uint64_t DistinctValues::write(Output& out)
+{
+    TraceSpan span("merge", "runs", runs.size());
+    int nsources = buffers.size() + runs.size();
+    std::vector<size_t> pos(buffers.size());
+    auto next = [&](int src, Item& item) {
+        if (src < buffers.size()) {
+            auto& items = buffers[src].items;
+            if (pos[src] == items.size())
+                return false;
+            item = std::move(items[pos[src]++]);
+            return true;
+        }
+        return readitem(runs[src - buffers.size()], item);
+    };
+    using Head = std::pair<Item, int>;
+    auto later = [](const Head& a, const Head& b) { return a.first > b.first; };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    for (int src = 0 ; src < nsources ; src++) {
+        Item item;
+        if (next(src, item))
+            heads.emplace(std::move(item), src);
+    }
+    std::string text;
+    uint64_t count = 0;
+    bool first = true;
+    T last = 0;
+    while (!heads.empty()) {
+        auto [item, src] = std::move(const_cast<Head&>(heads.top()));
+        heads.pop();
+        if (first || item.value != last) {
+            char buf[32];
+            auto r = std::to_chars(buf, buf+sizeof(buf), item.value);
+            text.append(buf, r.ptr);
+            if (withexpr) {
+                text += '=';
+                text += item.expr;
+            }
+            text += '\n';
+            if (text.size() > 0x10000) {
+                out.write(text);
+                text.clear();
+            }
+            count++;
+            last = item.value;
+            first = false;
+        }
+        Item nextitem;
+        if (next(src, nextitem))
+            heads.emplace(std::move(nextitem), src);
+    }
+    if (!text.empty())
+        out.write(text);
+    return count;
+}
+
+std::vector<int> Topology::parsecpulist(const std::string& text)
+{
+    std::vector<int> list;
+    for (auto item : stringsplitter<std::string>(text, ",")) {
+        int first, last;
+        int n = sscanf(item.c_str(), "%d-%d", &first, &last);
+        if (n == 1)
+            last = first;
+        if (n >= 1)
+            for (int c = first ; c <= last ; c++)
+                list.push_back(c);
+    }
+    return list;
+}
+
+Topology Topology::detect(const std::string& sysfs)
+{
+    Topology topo;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool haveaffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    // the nodes, in sysfs order, only those with allowed cpus get an index
+    std::string line;
+    std::ifstream online(sysfs + "/devices/system/node/online");
+    std::vector<int> nodes;
+    if (std::getline(online, line))
+        nodes = parsecpulist(line);
+    int nused = 0;
+    for (auto node : nodes) {
+        std::ifstream f(sysfs + "/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!std::getline(f, line))
+            continue;
+        bool used = false;
+        for (auto cpu : parsecpulist(line)) {
+            if (haveaffinity && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)))
+                continue;
+            topo.cpus.push_back(cpu);
+            topo.cpunode.push_back(nused);
+            used = true;
+        }
+        if (used)
+            nused++;
+    }
+    topo.nnodes = std::max(1, nused);
+    if (topo.cpus.empty() && haveaffinity) {
+        // no numa information: one node with all allowed cpus
+        for (int cpu = 0 ; cpu < CPU_SETSIZE ; cpu++)
+            if (CPU_ISSET(cpu, &allowed)) {
+                topo.cpus.push_back(cpu);
+                topo.cpunode.push_back(0);
+            }
+    }
+
+    // cgroup v2 cpu.max: "quota period" or "max period"
+    std::ifstream cpumax(sysfs + "/fs/cgroup/cpu.max");
+    long long q, period;
+    if (std::getline(cpumax, line) && sscanf(line.c_str(), "%lld %lld", &q, &period) == 2 && q > 0 && period > 0)
+        topo.quota = std::max(1LL, (q + period - 1) / period);
+#endif
+    if (topo.cpus.empty()) {
+        for (unsigned cpu = 0 ; cpu < std::max(1u, std::thread::hardware_concurrency()) ; cpu++) {
+            topo.cpus.push_back(cpu);
+            topo.cpunode.push_back(0);
+        }
+    }
+    return topo;
+}
+
+std::vector<int> Topology::placement(int nworkers) const
+{
+    std::vector<std::vector<int>> pernode(nnodes);
+    for (int k = 0 ; k < cpus.size() ; k++)
+        pernode[cpunode[k]].push_back(cpus[k]);
+    std::vector<int> place;
+    std::vector<int> used(nnodes);
+    for (int w = 0 ; w < nworkers ; w++) {
+        int node = w % nnodes;
+        place.push_back(pernode[node][used[node]++ % pernode[node].size()]);
+    }
+    return place;
+}
+
+int Topology::nodeof(int cpu) const
+{
+    for (int k = 0 ; k < cpus.size() ; k++)
+        if (cpus[k] == cpu)
+            return cpunode[k];
+    return 0;
+}
+
+const Topology& topology()
+{
+    static Topology topo = Topology::detect();
+    return topo;
+}
+
+bool pinthread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+#ifdef __linux__
+int PerfCounters::openevent(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void PerfCounters::start()
+{
+#ifdef __linux__
+    fds[CYCLES] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[INSTRUCTIONS] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[BRANCHMISSES] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds[CACHEMISSES] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[TASKCLOCK] = openevent(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+    for (int fd : fds)
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+void PerfCounters::stop()
+{
+#ifdef __linux__
+    for (int k = 0 ; k < NCOUNTERS ; k++) {
+        if (fds[k] < 0)
+            continue;
+        ioctl(fds[k], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t buf[3];   // value, time enabled, time running
+        if (read(fds[k], buf, sizeof(buf)) == sizeof(buf) && buf[2]) {
+            values[k] = buf[2] < buf[1] ? uint64_t(double(buf[0]) * buf[1] / buf[2]) : buf[0];
+            valid[k] = true;
+        }
+        close(fds[k]);
+        fds[k] = -1;
+    }
+#endif
+}
+
+#ifndef _WIN32
+volatile sig_atomic_t statusrequested = 0;
+
+void requeststatus(int)
+{
+    statusrequested = 1;
+}
+#endif
+
+Monitor::Monitor(const Engine& engine, const std::vector<std::unique_ptr<Worker>>& workers, uint64_t total, const SearchHooks *hooks)
+    : engine(engine), workers(workers), total(total), hooks(hooks)
+{
+#ifndef _WIN32
+    // an embedding program has its own signal handling
+    if (!hooks)
+        signal(SIGUSR1, requeststatus);
+#endif
+    th = std::thread([this]() { run(); });
+}
+
+Monitor::~Monitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        finished = true;
+    }
+    cv.notify_all();
+    th.join();
+}
+
+Monitor::Totals Monitor::totals() const
+{
+    Totals tot;
+    for (auto& w : workers) {
+        tot.evaluated += w->pubevaluated;
+        tot.hits += w->pubhits;
+        tot.tasks += w->pubtasks;
+        tot.steals += w->pubsteals;
+        tot.done += w->pubdone;
+    }
+    tot.seconds = t.elapsed() / 1e6;
+    return tot;
+}
+
+std::string Monitor::progressline() const
+{
+    auto tot = totals();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "progress %5.1f%%  %llu expr/sec  %llu hits  mem %lluMB  elapsed %s  eta %s\n",
+            total ? 100.0 * tot.done / total : 100.0, (unsigned long long)tot.rate(), (unsigned long long)tot.hits,
+            (unsigned long long)(memaccount.total()>>20),
+            formatduration(tot.seconds).c_str(), tot.done ? formatduration(eta(tot)).c_str() : "?");
+    return buf;
+}
+
+void Monitor::writemetrics() const
+{
+    auto tot = totals();
+    auto tmpname = engine.cfg.metricsfile + ".tmp";
+    {
+        std::ofstream f(tmpname);
+        f << "findexpr_expressions_total " << total << "\n";
+        f << "findexpr_expressions_done " << tot.done << "\n";
+        f << "findexpr_evaluated " << tot.evaluated << "\n";
+        f << "findexpr_hits " << tot.hits << "\n";
+        f << "findexpr_tasks_done " << tot.tasks << "\n";
+        f << "findexpr_tasks_total " << engine.tasks.size() << "\n";
+        f << "findexpr_steals " << tot.steals << "\n";
+        f << "findexpr_rate " << uint64_t(tot.rate()) << "\n";
+        f << "findexpr_elapsed_seconds " << tot.seconds << "\n";
+        f << "findexpr_eta_seconds " << eta(tot) << "\n";
+        for (auto& w : workers)
+            f << "findexpr_worker_evaluated{worker=\"" << w->id << "\"} " << w->pubevaluated << "\n";
+        for (int k = 0 ; k < MEM_NSUBSYSTEMS ; k++) {
+            f << "findexpr_memory_bytes{subsystem=\"" << memsubsystemnames[k] << "\"} " << memaccount.current[k] << "\n";
+            f << "findexpr_memory_peak_bytes{subsystem=\"" << memsubsystemnames[k] << "\"} " << memaccount.peak[k] << "\n";
+        }
+    }
+    rename(tmpname.c_str(), engine.cfg.metricsfile.c_str());
+}
+
+void Monitor::dumpstatus() const
+{
+    auto tot = totals();
+    std::ostringstream os;
+    os << "---- status\n";
+    os << "engine " << engine.cfg.engine << ( engine.info().empty() ? "" : ", ") << engine.info() << "\n";
+    os << "threads " << workers.size() << ", tasksize " << engine.cfg.tasksize << "\n";
+    os << "tasks " << tot.tasks << " of " << engine.tasks.size() << ", steals " << tot.steals << "\n";
+    os << "memory current/peak: " << memaccount.summary() << "\n";
+    os << progressline();
+    for (auto& w : workers)
+        os << "  worker " << w->id << ( engine.cfg.numa ? " node " + std::to_string(w->node) : "" ) << ": "
+           << w->pubtasks << " tasks, " << w->pubevaluated << " evaluated, " << w->pubhits << " hits, " << w->pubsteals << " steals\n";
+    os << "----\n";
+    std::cerr << os.str() << std::flush;
+}
+
+void Monitor::reportprogress() const
+{
+    auto tot = totals();
+    hooks->onprogress(tot.done, total, tot.evaluated, tot.hits, tot.seconds);
+}
+
+void Monitor::run()
+{
+    double interval = engine.cfg.progress;
+    if (!engine.cfg.metricsfile.empty() && interval == 0)
+        interval = 10;
+    bool hooked = hooks && hooks->onprogress;
+    if (hooked)
+        interval = hooks->progressinterval;
+    timer tick;
+    std::unique_lock<std::mutex> lock(m);
+    // wake up regularly to check for a status request
+    while (!cv.wait_for(lock, std::chrono::milliseconds(100), [this]() { return finished; })) {
+#ifndef _WIN32
+        if (statusrequested) {
+            statusrequested = 0;
+            dumpstatus();
+        }
+#endif
+        if (interval && tick.elapsed() > interval*1e6) {
+            tick.lap();
+            if (engine.cfg.progress)
+                std::cerr << progressline() << std::flush;
+            if (!engine.cfg.metricsfile.empty())
+                writemetrics();
+            if (hooked)
+                reportprogress();
+        }
+    }
+    if (!engine.cfg.metricsfile.empty())
+        writemetrics();
+    if (hooked)
+        reportprogress();
+}
+
+SearchStats runsearch(Engine& engine, int nthreads, Output *out, std::vector<size_t> order, double timelimit, const SearchHooks *hooks)
+{
+    if (order.empty())
+        for (size_t k = 0 ; k < engine.tasks.size() ; k++)
+            order.push_back(k);
+
+    std::vector<std::atomic<int>> remaining(engine.shapenames.size());
+    for (auto pos : order)
+        remaining[engine.tasks[pos].shape]++;
+
+    timer t, tshape;
+
+    // --ordered: the shape line is written after the last task of the shape
+    std::unique_ptr<ReorderBuffer> reorder;
+    bool ordered = engine.cfg.ordered && out;
+    if (ordered)
+        reorder = std::make_unique<ReorderBuffer>(out, 4*nthreads, [&](size_t pos) {
+                int shape = engine.tasks[order[pos]].shape;
+                if (pos+1 < order.size() && engine.tasks[order[pos+1]].shape == shape)
+                    return std::string();
+                std::ostringstream os;
+                os << "=========" << tshape.lap() << " usec   " << engine.shapenames[shape] << '\n';
+                return os.str();
+            });
+
+    // --numa: each worker is pinned to a cpu, spread over the nodes
+    bool numa = engine.cfg.numa;
+    std::vector<int> placement, nodes;
+    if (numa) {
+        placement = topology().placement(nthreads);
+        for (auto cpu : placement)
+            nodes.push_back(topology().nodeof(cpu));
+    }
+
+    // --pipeline: formatting and writing the hits run on their own threads
+    std::unique_ptr<Pipeline> pipeline;
+    if (engine.cfg.pipeline && out && !ordered)
+        pipeline = std::make_unique<Pipeline>(out, nthreads, engine.cfg.formatthreads, engine.cfg.queuesize);
+
+    std::unique_ptr<HashSet> dedup;
+    if (engine.cfg.dedup)
+        dedup = std::make_unique<HashSet>();
+    if (reorder)
+        reorder->dedup = dedup.get();
+    std::shared_ptr<DistinctValues> distinct;
+    if (engine.cfg.distinct)
+        distinct = std::make_shared<DistinctValues>(nthreads, engine.cfg.distinct > 1, engine.cfg.sortmemory, engine.cfg.tmpdir);
+
+    Scheduler sched(order.size(), nthreads, ordered, nodes);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int w = 0 ; w < nthreads ; w++) {
+        workers.push_back(std::make_unique<Worker>(w, out));
+        if (numa)
+            workers.back()->node = nodes[w];
+        if (engine.cfg.profile)
+            workers.back()->startprofile(engine.shapenames.size(), engine.cfg.binops.size());
+        workers.back()->collecting = engine.cfg.collecthits;
+        workers.back()->hooks = hooks;
+        workers.back()->reorder = reorder.get();
+        workers.back()->pipeline = pipeline.get();
+        workers.back()->dedup = dedup.get();
+        workers.back()->distinct = distinct.get();
+        if (engine.cfg.estimate)
+            workers.back()->estimate = std::make_unique<DistinctEstimate>();
+        if (engine.cfg.coverage)
+            workers.back()->reached = std::make_unique<IntBitmap>();
+        workers.back()->batchsize = engine.cfg.batchsize;
+    }
+
+    std::mutex shapemutex;
+    std::atomic<bool> stop = false;
+    auto work = [&](Worker& w) {
+        tracethread("worker " + std::to_string(w.id));
+        if (numa)
+            pinthread(placement[w.id]);
+        if (engine.cfg.perfcounters)
+            w.perf.start();
+        size_t pos;
+        while (!stop && !(hooks && hooks->cancelled()) && sched.next(w, pos)) {
+            auto& task = engine.tasks[order[pos]];
+            if (ordered)
+                reorder->waitfor(pos);
+            timer ttask;
+            {
+                TraceSpan span("evaluate", "shape", task.shape, "count", task.last - task.first);
+                engine.runtask(task, w);
+            }
+            uint64_t usec = ttask.elapsed();
+            w.busyusec += usec;
+            if (w.profiling)
+                w.shapeprof[task.shape].usec += usec;
+            w.tasks++;
+            w.done += task.last - task.first;
+            w.publish();
+            if (ordered)
+                w.submit(pos);
+            else if (--remaining[task.shape] == 0 && out) {
+                w.flush();
+                std::lock_guard<std::mutex> lock(shapemutex);
+                std::ostringstream os;
+                os << "=========" << tshape.lap() << " usec   " << engine.shapenames[task.shape] << '\n';
+                if (pipeline)
+                    w.handover(os.str());
+                else
+                    out->write(os.str());
+            }
+            if (timelimit && t.elapsed() > timelimit*1e6)
+                stop = true;
+        }
+        if (engine.cfg.perfcounters)
+            w.perf.stop();
+        w.flush();
+        if (pipeline)
+            pipeline->hits.close();
+        if (distinct)
+            distinct->finish(w.id);
+    };
+    std::unique_ptr<Monitor> monitor;
+    if (out || engine.cfg.distinct || engine.cfg.estimate || engine.cfg.coverage || (hooks && hooks->onprogress)) {
+        uint64_t total = 0;
+        for (auto pos : order)
+            total += engine.tasks[pos].last - engine.tasks[pos].first;
+        monitor = std::make_unique<Monitor>(engine, workers, total, hooks);
+    }
+
+    // with --numa all workers get their own thread, so the main thread is not pinned
+    std::vector<std::thread> threads;
+    for (int w = numa ? 0 : 1 ; w < nthreads ; w++)
+        threads.emplace_back(work, std::ref(*workers[w]));
+    if (!numa)
+        work(*workers[0]);
+    for (auto& th : threads)
+        th.join();
+    SearchStats stats;
+    stats.distinct = distinct;
+    if (pipeline) {
+        stats.pipelinewaits = pipeline->hits.fullwaits;
+        pipeline.reset();
+    }
+    monitor.reset();
+
+    stats.seconds = t.elapsed() / 1e6;
+    for (auto& w : workers) {
+        stats.evaluated += w->evaluated;
+        stats.hits += w->hits;
+        stats.tasks += w->tasks;
+        stats.steals += w->steals;
+        stats.remotesteals += w->remotesteals;
+        stats.duplicates += w->duplicates;
+        if (w->estimate) {
+            if (!stats.estimate)
+                stats.estimate = std::make_shared<DistinctEstimate>();
+            stats.estimate->merge(*w->estimate);
+        }
+        if (w->reached) {
+            if (!stats.reached)
+                stats.reached = std::make_shared<IntBitmap>();
+            stats.reached->unite(*w->reached);
+            w->reached.reset();
+        }
+        stats.workerevaluated.push_back(w->evaluated);
+        stats.workerbusy.push_back(w->busyusec / 1e6);
+        stats.perf.push_back(w->perf);
+        stats.collected.insert(stats.collected.end(), w->collected.begin(), w->collected.end());
+        if (w->profiling) {
+            stats.shapeprof.resize(w->shapeprof.size());
+            stats.opvalid.resize(w->opvalid.size());
+            stats.ophits.resize(w->ophits.size());
+            for (int k = 0 ; k < w->shapeprof.size() ; k++) {
+                auto& sp = stats.shapeprof[k];
+                sp.usec += w->shapeprof[k].usec;
+                sp.evaluated += w->shapeprof[k].evaluated;
+                sp.nan += w->shapeprof[k].nan;
+                sp.inf += w->shapeprof[k].inf;
+                sp.hits += w->shapeprof[k].hits;
+            }
+            for (int k = 0 ; k < w->opvalid.size() ; k++) {
+                stats.opvalid[k] += w->opvalid[k];
+                stats.ophits[k] += w->ophits[k];
+            }
+        }
+    }
+    if (reorder) {
+        // the hits were counted by the workers, before the reorder buffer dropped the duplicates
+        stats.duplicates += reorder->duplicates;
+        stats.hits -= reorder->duplicates;
+    }
+    return stats;
+}
+
+void parallel(int nthreads, std::function<void(int)> fn)
+{
+    std::vector<std::thread> threads;
+    for (int w = 1 ; w < nthreads ; w++)
+        threads.emplace_back(fn, w);
+    fn(0);
+    for (auto& th : threads)
+        th.join();
+}
+
+void pinnedparallel(const std::vector<int>& cpus, std::function<void(int)> fn)
+{
+    std::vector<std::thread> threads;
+    for (int k = 0 ; k < cpus.size() ; k++)
+        threads.emplace_back([&, k]() {
+                pinthread(cpus[k]);
+                fn(k);
+            });
+    for (auto& th : threads)
+        th.join();
+}
+
+Generator<EvalResult> enumresults(const SearchConfig& cfg, Node::ptr expr, uint64_t first, uint64_t last)
+{
+    auto inums = iter(cfg.nums);
+    setvalues(expr, inums);
+    int nops = cfg.nums.size()-1;
+    for (auto& a : opassignments(cfg.binops, nops, first, last, cfg.widening ? cfg.isold : std::vector<bool>())) {
+        auto iops = iter(a.ops);
+        setops(expr, iops);
+        co_yield EvalResult{ a.index, expr->eval() };
+    }
+}
+
+SetSizes setsizes(const ValueSets& vs)
+{
+    SetSizes size(vs.sets.size());
+    for (int k = 0 ; k < size.size() ; k++)
+        size[k] = vs.sets[k].size();
+    return size;
+}
+
+double levelcost(const SetSizes& size, int n, int nops, int len)
+{
+    double cost = 0;
+    for (int i = 0 ; i+len <= n ; i++)
+        for (int k = i+1 ; k < i+len ; k++)
+            cost += size[i*(n+1)+k] * size[k*(n+1)+i+len] * nops;
+    return cost;
+}
+
+void buildset(ValueSets& vs, const SearchConfig& cfg, int i, int j)
+{
+    TraceSpan span("dp merge", "i", i, "j", j);
+    auto& set = vs.at(i,j);
+    if (j-i==1) {
+        set.push_back({T(cfg.nums[i]), -1, -1, -1, -1, false});
+        return;
+    }
+    std::unordered_map<uint64_t, int, std::hash<uint64_t>, std::equal_to<uint64_t>,
+        CountingAllocator<std::pair<const uint64_t, int>, MEM_HASHTABLES>> seen;
+    for (int k = j-1 ; k > i ; k--) {
+        auto& ls = vs.at(i,k);
+        auto& rs = vs.at(k,j);
+        for (int a = 0 ; a < ls.size() ; a++)
+            for (int b = 0 ; b < rs.size() ; b++)
+                for (int o = 0 ; o < cfg.binops.size() ; o++) {
+                    T v = cfg.binops[o]->bin(ls[a].value, rs[b].value);
+                    if (std::isnan(v))
+                        continue;
+                    bool isnew = ls[a].isnew || rs[b].isnew || !cfg.isold[o];
+                    auto ins = seen.emplace(valuebits(v), set.size());
+                    if (ins.second)
+                        set.push_back({v, k, o, a, b, isnew});
+                    else if (set[ins.first->second].isnew && !isnew)
+                        // prefer a derivation using only old operations.
+                        set[ins.first->second] = {v, k, o, a, b, isnew};
+                }
+    }
+    set.shrink_to_fit();
+}
+
+double topcost(const SetSizes& size, int n, int nops, int L, int i, int j)
+{
+    if (j-i <= L)
+        return size[i*(n+1)+j];
+    double cost = 0;
+    for (int k = i+1 ; k < j ; k++)
+        cost += topcost(size, n, nops, L, i, k) * topcost(size, n, nops, L, k, j) * nops;
+    return cost;
+}
+
+bool worthbuilding(const SetSizes& size, int n, int nops, int len, double ratio, size_t membudget)
+{
+    double bytes = 0;
+    for (int i = 0 ; i < n ; i++)
+        for (int j = i+1 ; j <= std::min(n, i+len) ; j++)
+            bytes += size[i*(n+1)+j]*sizeof(SetEntry);
+    double work = levelcost(size, n, nops, len+1);
+    return bytes + work*ratio*sizeof(SetEntry) <= membudget && work < topcost(size, n, nops, len, 0, n);
+}
+
+int buildsets(ValueSets& vs, const SearchConfig& cfg, int L, size_t membudget, int nthreads)
+{
+    int n = cfg.nums.size();
+    int nops = cfg.binops.size();
+    for (int i = 0 ; i < n ; i++)
+        buildset(vs, cfg, i, i+1);
+
+    double ratio = 1;     // observed fraction of distinct values per evaluation
+    int len = 1;
+    while (len < n) {
+        if (L == 0 ? !worthbuilding(setsizes(vs), n, nops, len, ratio, membudget) : len >= L)
+            break;
+        double work = levelcost(setsizes(vs), n, nops, len+1);
+        // the new sets, and their hash tables while building: about 48 bytes per entry
+        double estimate = work*ratio*(sizeof(SetEntry) + 48);
+        if (cfg.maxmemory && memaccount.total() + estimate > cfg.maxmemory) {
+            std::cerr << "memory limit: value sets limited to length " << len << ", the rest is enumerated\n";
+            break;
+        }
+        len++;
+        // the intervals of one level are independent, build them in parallel.
+        std::atomic<int> next = 0;
+        parallel(std::min(nthreads, n-len+1), [&](int t) {
+                if (t)
+                    tracethread("build " + std::to_string(t));
+                for (int i = next++ ; i+len <= n ; i = next++)
+                    buildset(vs, cfg, i, i+len);
+            });
+        size_t entries = 0;
+        for (int i = 0 ; i+len <= n ; i++)
+            entries += vs.at(i, i+len).size();
+        if (work)
+            ratio = entries/work;
+    }
+    return len;
+}
+
+Generator<Skeleton> skeletonshapes(int i, int j, int L)
+{
+    if (j-i <= L) {
+        Skeleton s;
+        s.leaves.emplace_back(i, j);
+        s.code.push_back(0);
+        co_yield s;
+        co_return;
+    }
+    // same order as treeshapes: largest left subtree first.
+    for (int k = j-1 ; k > i ; k--)
+        for (auto& l : skeletonshapes(i, k, L))
+            for (auto& r : skeletonshapes(k, j, L)) {
+                Skeleton s = l;
+                s.leaves.insert(s.leaves.end(), r.leaves.begin(), r.leaves.end());
+                for (auto c : r.code)
+                    s.code.push_back(c<0 ? c : c + l.leaves.size());
+                s.code.push_back(-1);
+                s.nops = l.nops + r.nops + 1;
+                co_yield s;
+            }
+}
+
+std::string describe(const Skeleton& sk, const std::vector<int>& nums)
+{
+    std::vector<std::string> stack;
+    for (auto c : sk.code) {
+        if (c >= 0) {
+            auto [i, j] = sk.leaves[c];
+            std::string txt = j-i>1 ? "{" : "";
+            for (int k = i ; k < j ; k++)
+                txt += (k>i ? " " : "") + std::to_string(nums[k]);
+            stack.push_back(j-i>1 ? txt + "}" : txt);
+        }
+        else {
+            auto r = stack.back(); stack.pop_back();
+            auto l = stack.back(); stack.pop_back();
+            stack.push_back("(" + l + "#" + r + ")");
+        }
+    }
+    return stack.back();
+}
+
+Node::ptr makenode(const ValueSets& vs, const SearchConfig& cfg, int i, int j, int idx)
+{
+    auto& e = vs.at(i,j)[idx];
+    if (e.split < 0) {
+        auto v = Value::make();
+        v->value = e.value;
+        return v;
+    }
+    auto x = Expr::make(makenode(vs, cfg, i, e.split, e.left), makenode(vs, cfg, e.split, j, e.right));
+    x->op = cfg.binops[e.op];
+    return x;
+}
+
+Node::ptr makenode(const ValueSets& vs, const SearchConfig& cfg, const Skeleton& sk, const std::vector<int>& choice, const std::vector<int>& ops)
+{
+    std::vector<Node::ptr> stack;
+    int iop = 0;
+    for (auto c : sk.code) {
+        if (c >= 0) {
+            stack.push_back(makenode(vs, cfg, sk.leaves[c].first, sk.leaves[c].second, choice[c]));
+        }
+        else {
+            auto r = stack.back(); stack.pop_back();
+            auto l = stack.back(); stack.pop_back();
+            auto x = Expr::make(l, r);
+            x->op = cfg.binops[ops[iop++]];
+            stack.push_back(x);
+        }
+    }
+    return stack.back();
+}
+
+LaneKernel findlanekernel(const Operation *op)
+{
+    if (op->name == "add") return lanekernel<std::plus<T>>;
+    if (op->name == "sub") return lanekernel<std::minus<T>>;
+    if (op->name == "mul") return lanekernel<std::multiplies<T>>;
+    if (op->name == "div") return lanekernel<std::divides<T>>;
+    return lanecall;
+}
+
+void evallanes(const Skeleton& sk, const std::vector<Operation*>& binops, const std::vector<LaneKernel>& kernels,
+        const T *leafvalues, const int *ops, T *result)
+{
+    alignas(64) T stack[64][LANES];
+    int sp = 0;
+    for (auto c : sk.code) {
+        if (c >= 0) {
+            std::copy(leafvalues + c*LANES, leafvalues + (c+1)*LANES, stack[sp++]);
+        }
+        else {
+            sp--;
+            kernels[*ops](stack[sp-1], stack[sp], binops[*ops]->bin);
+            ops++;
+        }
+    }
+    std::copy(stack[0], stack[0] + LANES, result);
+}
+
+void printmemory()
+{
+    char buf[256];
+    std::ostringstream os;
+    os << "---- memory\n";
+    snprintf(buf, sizeof(buf), "%-16s %16s %16s\n", "subsystem", "current", "peak");
+    os << buf;
+    for (int k = 0 ; k < MEM_NSUBSYSTEMS ; k++) {
+        snprintf(buf, sizeof(buf), "%-16s %16lld %16lld\n", memsubsystemnames[k], (long long)memaccount.current[k], (long long)memaccount.peak[k]);
+        os << buf;
+    }
+    snprintf(buf, sizeof(buf), "%-16s %16lld %16lld\n", "total", (long long)memaccount.total(), (long long)memaccount.totalpeak);
+    os << buf;
+    std::cerr << os.str();
+}
+
+void printprofile(const Engine& engine, const SearchStats& stats)
+{
+    uint64_t totalusec = 0;
+    for (auto& sp : stats.shapeprof)
+        totalusec += sp.usec;
+
+    char buf[256];
+    std::ostringstream os;
+    os << "---- profile per shape\n";
+    snprintf(buf, sizeof(buf), "%12s %6s %14s %7s %7s %10s  %s\n", "usec", "time%", "evaluated", "nan%", "inf%", "hits", "shape");
+    os << buf;
+    for (int k = 0 ; k < stats.shapeprof.size() ; k++) {
+        auto& sp = stats.shapeprof[k];
+        double n = sp.evaluated ? sp.evaluated : 1;
+        snprintf(buf, sizeof(buf), "%12llu %6.2f %14llu %7.3f %7.3f %10llu  %s\n", (unsigned long long)sp.usec,
+                totalusec ? 100.0*sp.usec/totalusec : 0.0, (unsigned long long)sp.evaluated,
+                100.0*sp.nan/n, 100.0*sp.inf/n, (unsigned long long)sp.hits, engine.shapenames[k].c_str());
+        os << buf;
+    }
+    os << "---- profile per operation: nr of finite results and hits using it\n";
+    for (int k = 0 ; k < stats.opvalid.size() ; k++) {
+        snprintf(buf, sizeof(buf), "%-4s %14llu %10llu\n", engine.cfg.binops[k]->infix.c_str(),
+                (unsigned long long)stats.opvalid[k], (unsigned long long)stats.ophits[k]);
+        os << buf;
+    }
+    std::cerr << os.str();
+}
+
+void printperf(const Engine& engine, const SearchStats& stats)
+{
+    char buf[256];
+    std::ostringstream os;
+    os << "---- perf counters, engine " << engine.cfg.engine << "\n";
+    snprintf(buf, sizeof(buf), "%-7s %14s %12s %16s %16s %6s %14s %14s %10s %10s\n", "worker", "evaluated", "task-msec",
+            "cycles", "instructions", "IPC", "branch-misses", "cache-misses", "cyc/expr", "ns/expr");
+    os << buf;
+
+    auto line = [&](const std::string& name, uint64_t evaluated, const PerfCounters& pc) {
+        auto value = [&](int k) -> std::string {
+            return pc.valid[k] ? std::to_string(pc.values[k]) : "-";
+        };
+        std::string ipc = "-", cpe = "-", msec = "-", npe = "-";
+        if (pc.valid[PerfCounters::CYCLES] && pc.valid[PerfCounters::INSTRUCTIONS] && pc.values[PerfCounters::CYCLES]) {
+            snprintf(buf, sizeof(buf), "%.2f", double(pc.values[PerfCounters::INSTRUCTIONS]) / pc.values[PerfCounters::CYCLES]);
+            ipc = buf;
+        }
+        if (pc.valid[PerfCounters::CYCLES] && evaluated) {
+            snprintf(buf, sizeof(buf), "%.1f", double(pc.values[PerfCounters::CYCLES]) / evaluated);
+            cpe = buf;
+        }
+        if (pc.valid[PerfCounters::TASKCLOCK]) {
+            msec = std::to_string(pc.values[PerfCounters::TASKCLOCK] / 1000000);
+            if (evaluated) {
+                snprintf(buf, sizeof(buf), "%.1f", double(pc.values[PerfCounters::TASKCLOCK]) / evaluated);
+                npe = buf;
+            }
+        }
+        snprintf(buf, sizeof(buf), "%-7s %14llu %12s %16s %16s %6s %14s %14s %10s %10s\n", name.c_str(), (unsigned long long)evaluated,
+                msec.c_str(), value(PerfCounters::CYCLES).c_str(), value(PerfCounters::INSTRUCTIONS).c_str(), ipc.c_str(),
+                value(PerfCounters::BRANCHMISSES).c_str(), value(PerfCounters::CACHEMISSES).c_str(), cpe.c_str(), npe.c_str());
+        os << buf;
+    };
+
+    PerfCounters total;
+    std::fill(std::begin(total.valid), std::end(total.valid), true);
+    for (int w = 0 ; w < stats.perf.size() ; w++) {
+        line(std::to_string(w), stats.workerevaluated[w], stats.perf[w]);
+        for (int k = 0 ; k < PerfCounters::NCOUNTERS ; k++) {
+            total.values[k] += stats.perf[w].values[k];
+            total.valid[k] &= stats.perf[w].valid[k];
+        }
+    }
+    line("total", stats.evaluated, total);
+    if (!total.valid[PerfCounters::CYCLES])
+        os << "hardware counters not available, check /proc/sys/kernel/perf_event_paranoid\n";
+    std::cerr << os.str();
+}
+
+std::unique_ptr<Engine> makeengine(const SearchConfig& cfg)
+{
+    if (cfg.engine == "enum" && !cfg.sequences.empty())
+        return std::make_unique<LanesEngine>(cfg);
+    if (cfg.engine == "enum")
+        return std::make_unique<EnumEngine>(cfg);
+    if (cfg.engine == "hybrid" || cfg.engine == "dp")
+        return std::make_unique<HybridEngine>(cfg);
+    return nullptr;
+}
+
+void printestimate(const DistinctEstimate& est, const SearchStats& stats)
+{
+    char buf[256];
+    double total = est.all.estimate();
+    snprintf(buf, sizeof(buf), "estimated distinct values: %.0f ( +- %.1f%% ), of %llu hits, %.1f sec\n",
+            total, 100*est.all.error(), (unsigned long long)stats.hits, stats.seconds);
+    std::cout << buf;
+    snprintf(buf, sizeof(buf), "a value set of this size takes about %.0f MB\n", total * sizeof(SetEntry) / 1e6);
+    std::cout << buf;
+    snprintf(buf, sizeof(buf), "%-24s %14s  ( +- %.1f%% )\n", "range", "distinct", 100*est.ranges[0].error());
+    std::cout << buf;
+    for (int r = 0 ; r < DistinctEstimate::NRANGES ; r++) {
+        double e = est.ranges[r].estimate();
+        if (e < 0.5)
+            continue;
+        snprintf(buf, sizeof(buf), "%-24s %14.0f\n", DistinctEstimate::rangename(r).c_str(), e);
+        std::cout << buf;
+    }
+}
+
+void printcoverage(IntBitmap reached, uint64_t n)
+{
+    IntBitmap range;
+    range.addrange(0, n);
+    reached.intersect(range);
+    std::cout << "reached " << reached.count() << " of the integers 0 .. " << n-1 << "\n";
+    uint64_t v = reached.firstmissing(1);
+    // n itself was not tested
+    if (v >= n) {
+        std::cout << "all of " << (reached.contains(0) ? 0 : 1) << " .. " << n-1 << " reached\n";
+        return;
+    }
+    std::cout << "lowest positive integer not reached: " << v << "\n";
+    std::cout << "not reached:";
+    for (int k = 0 ; k < 20 && v < n ; k++, v = reached.firstmissing(v+1))
+        std::cout << " " << v;
+    if (v < n)
+        std::cout << " ...";
+    std::cout << "\n";
+}
+
+void search(const SearchConfig& cfg)
+{
+    tracer.enabled = !cfg.tracefile.empty();
+    tracethread("main");
+
+    timer t;
+    auto engine = makeengine(cfg);
+    {
+        TraceSpan span("prepare");
+        engine->prepare(cfg.nthreads);
+        engine->maketasks(cfg.tasksize);
+    }
+    double preptime = t.elapsed() / 1e6;
+    bool collect = cfg.distinct || cfg.estimate || cfg.coverage;
+    if (!engine->info().empty() && !collect)
+        std::cout << "=========" << t.lap() << " usec   " << engine->info() << std::endl;
+
+    Output out;
+    if (cfg.uring) {
+        std::cout.flush();
+        out.async = std::make_unique<AsyncWriter>(1, cfg.uring, cfg.uringbuffer);
+    }
+    // --distinct and --estimate: the hits are collected by the workers, and merged when the search is done
+    auto stats = runsearch(*engine, cfg.nthreads, collect ? nullptr : &out);
+    if (cfg.estimate)
+        printestimate(*stats.estimate, stats);
+    if (cfg.coverage)
+        printcoverage(*stats.reached, cfg.coverage);
+    if (cfg.distinct) {
+        timer tmerge;
+        uint64_t count = stats.distinct->write(out);
+        std::cerr << "distinct: " << count << " values of " << stats.hits << " hits, "
+                  << stats.distinct->spilled << " values in " << stats.distinct->runs.size() << " run files, merged in "
+                  << formatduration(tmerge.elapsed() / 1e6) << "\n";
+    }
+    if (cfg.uring) {
+        out.finish();
+        std::cerr << out.async->report() << "\n";
+    }
+    if (cfg.profile)
+        printprofile(*engine, stats);
+    if (cfg.perfcounters)
+        printperf(*engine, stats);
+    if (tracer.enabled)
+        tracer.write(cfg.tracefile);
+    if (cfg.memstats || cfg.progress)
+        printmemory();
+    if (cfg.pipeline && cfg.progress)
+        std::cerr << "pipeline: " << cfg.formatthreads << " format threads, " << stats.pipelinewaits
+                  << " batches waited for a full queue\n";
+    if (cfg.dedup)
+        std::cerr << "dedup: " << stats.duplicates << " of " << stats.hits + stats.duplicates << " hits were duplicates\n";
+    if (cfg.numa)
+        std::cerr << "numa: " << topology().nnodes << " nodes, " << topology().cpus.size() << " cpus, "
+                  << stats.remotesteals << " of " << stats.steals << " steals across nodes\n";
+    if (cfg.summary) {
+        std::cout.flush();
+        char buf[256];
+        // space: the nr of expressions covered, the same for all engines
+        double space = countshapes(cfg.nums.size()) * std::pow(double(cfg.binops.size()), cfg.nums.size()-1);
+        snprintf(buf, sizeof(buf), "summary space=%.0f evaluated=%llu hits=%llu tasks=%llu steals=%llu remotesteals=%llu prepare=%.6f search=%.6f peakmem=%lld threads=%d",
+                space, (unsigned long long)stats.evaluated, (unsigned long long)stats.hits, (unsigned long long)stats.tasks,
+                (unsigned long long)stats.steals, (unsigned long long)stats.remotesteals, preptime, stats.seconds, (long long)memaccount.totalpeak, cfg.nthreads);
+        std::string line = buf;
+        // per worker: the seconds not spent running tasks
+        line += " idle=";
+        for (int k = 0 ; k < stats.workerbusy.size() ; k++) {
+            snprintf(buf, sizeof(buf), "%s%.6f", k ? "," : "", std::max(0.0, stats.seconds - stats.workerbusy[k]));
+            line += buf;
+        }
+        std::cerr << line << "\n";
+    }
+}
+
+uint64_t countshapes(int n)
+{
+    std::vector<uint64_t> c(n+1);
+    c[1] = 1;
+    for (int k = 2 ; k <= n ; k++)
+        for (int i = 1 ; i < k ; i++)
+            c[k] += c[i]*c[k-i];
+    return c[n];
+}
+
+void plansearch(const SearchConfig& cfg, int nsamples)
+{
+    const std::string& engine = cfg.engine;
+    int L = cfg.maxlen;
+    size_t membudget = cfg.membudget;
+    int n = cfg.nums.size();
+    int nops = cfg.binops.size();
+    int nold = std::count(cfg.isold.begin(), cfg.isold.end(), true);
+
+    std::cout << "numbers:    ";
+    for (auto v : cfg.nums)
+        std::cout << " " << v;
+    // several sequences: the lanes engine searches each of them, only with -e enum
+    uint64_t nseq = std::max<size_t>(1, cfg.sequences.size());
+    if (nseq > 1)
+        std::cout << ", and " << nseq-1 << " more sequences";
+    std::cout << "\noperations: ";
+    for (auto op : cfg.binops)
+        std::cout << " " << op->infix;
+    std::cout << "\n";
+
+    uint64_t nshapes = countshapes(n);
+    uint64_t nassign = upow(nops, n-1);
+    uint64_t nskip = cfg.widening ? upow(nold, n-1) : 0;
+    std::cout << "shapes:                 " << nshapes << "\n";
+    std::cout << "op assignments / shape: " << nassign << ", skipped by -w: " << nskip << "\n";
+    if (nseq > 1)
+        std::cout << "sequences:              " << nseq << "\n";
+    std::cout << "expressions:            " << nseq*nshapes*(nassign-nskip) << "\n";
+
+    std::mt19937_64 rng(1);
+    volatile T sink = 0;
+    timer t;
+
+    if (engine == "enum" && nseq > 1) {
+        // the lanes engine: sample the evaluation of LANES sequences at once
+        std::vector<Skeleton> skeletons;
+        for (auto& sk : skeletonshapes(0, n, 1))
+            skeletons.push_back(sk);
+        std::vector<LaneKernel> kernels;
+        for (auto op : cfg.binops)
+            kernels.push_back(findlanekernel(op));
+        std::vector<T> leafvalues(n * LANES);
+        for (int l = 0 ; l < LANES ; l++)
+            for (int k = 0 ; k < n ; k++)
+                leafvalues[k*LANES + l] = cfg.sequences[l % nseq][k];
+        std::vector<int> ops(n);
+        alignas(64) T results[LANES];
+
+        t.lap();
+        for (int k = 0 ; k < nsamples ; k++) {
+            auto& sk = skeletons[rng() % skeletons.size()];
+            for (int p = 0 ; p < sk.nops ; p++)
+                ops[p] = rng() % nops;
+            evallanes(sk, cfg.binops, kernels, leafvalues.data(), ops.data(), results);
+            sink = results[k % LANES];
+        }
+        double rate = double(nsamples) * LANES / (t.lap() / 1e6);
+        std::cout << "sample rate:            " << uint64_t(rate) << " expr/sec, in " << LANES << " lanes\n";
+        std::cout << "threads:                " << cfg.nthreads << ", assuming linear scaling\n";
+        std::cout << "estimated runtime:      " << formatduration(nseq*nshapes*(nassign-nskip) / rate / cfg.nthreads) << "\n";
+        (void)sink;
+        return;
+    }
+    if (engine == "enum") {
+        std::vector<Node::ptr> shapes;
+        for (auto expr : treeshapes(n))
+            shapes.push_back(expr);
+
+        t.lap();
+        for (int k = 0 ; k < nsamples ; k++) {
+            auto expr = shapes[rng() % shapes.size()];
+            auto iops = opsgenerator(cfg.binops, rng() % nassign);
+            auto inums = iter(cfg.nums);
+            setvalues(expr, inums);
+            setops(expr, iops);
+            sink = expr->eval();
+        }
+        double rate = nsamples / (t.lap() / 1e6);
+        std::cout << "sample rate:            " << uint64_t(rate) << " expr/sec\n";
+        std::cout << "threads:                " << cfg.nthreads << ", assuming linear scaling\n";
+        std::cout << "estimated runtime:      " << formatduration(nshapes*(nassign-nskip) / rate / cfg.nthreads) << "\n";
+        (void)sink;
+        return;
+    }
+
+    // both hybrid and dp: build the short value sets, and extrapolate the size of the
+    // others using the fraction of distinct values found in the last level built.
+    // Levels are built while that takes less than `planlimit` evaluations.
+    const double planlimit = 2e6;
+    int maxlen = L;
+    ValueSets vs(n);
+    for (int i = 0 ; i < n ; i++)
+        buildset(vs, cfg, i, i+1);
+    int built = 1;
+    double ratio = 1;
+    while (built < n && (maxlen == 0 || built < maxlen)) {
+        double work = levelcost(setsizes(vs), n, nops, built+1);
+        if (work > planlimit)
+            break;
+        if (maxlen == 0 && !worthbuilding(setsizes(vs), n, nops, built, ratio, membudget))
+            break;
+        built++;
+        double entries = 0;
+        for (int i = 0 ; i+built <= n ; i++) {
+            buildset(vs, cfg, i, i+built);
+            entries += vs.at(i, i+built).size();
+        }
+        if (work)
+            ratio = entries / work;
+    }
+    double buildtime = t.lap() / 1e6;
+    double buildwork = 0;
+    for (int len = 2 ; len <= built ; len++)
+        buildwork += levelcost(setsizes(vs), n, nops, len);
+    double buildrate = buildwork ? buildwork / buildtime : 1e6;
+
+    SetSizes size = setsizes(vs);
+    for (int len = built+1 ; len <= n ; len++)
+        for (int i = 0 ; i+len <= n ; i++) {
+            int j = i+len;
+            double combos = 0;
+            for (int k = i+1 ; k < j ; k++)
+                combos += size[i*(n+1)+k] * size[k*(n+1)+j] * nops;
+            size[i*(n+1)+j] = combos * ratio;
+        }
+
+    // the length the search would use
+    L = maxlen;
+    if (L == 0) {
+        L = 1;
+        while (L < n && worthbuilding(size, n, nops, L, ratio, membudget))
+            L++;
+    }
+    // the sets of one level are built in parallel, one thread per interval
+    double settime = 0, setbytes = 0;
+    for (int len = 1 ; len <= n ; len++) {
+        double work = levelcost(size, n, nops, len);
+        double entries = 0;
+        for (int i = 0 ; i+len <= n ; i++)
+            entries += size[i*(n+1)+i+len];
+        if (len <= L) {
+            settime += work / buildrate / std::min(cfg.nthreads, n-len+1);
+            setbytes += entries*sizeof(SetEntry);
+        }
+        std::cout << "  length " << len << (len <= built ? ":          " : ", estimate:") << " "
+            << uint64_t(work) << " evaluations, " << uint64_t(entries) << " distinct values, "
+            << uint64_t(entries*sizeof(SetEntry)) << " bytes\n";
+    }
+    // the hash table used while building the largest set: about 48 bytes per entry
+    double hashbytes = 0;
+    for (int i = 0 ; i+L <= n ; i++)
+        hashbytes = std::max(hashbytes, size[i*(n+1)+i+L] * 48);
+    std::cout << "value sets up to length " << L << "\n";
+    std::cout << "estimated memory:       " << uint64_t(setbytes + hashbytes) << " bytes\n";
+    std::cout << "build rate:             " << uint64_t(buildrate) << " evaluations/sec\n";
+    std::cout << "threads:                " << cfg.nthreads << ", assuming linear scaling\n";
+    if (engine == "dp") {
+        std::cout << "estimated runtime:      " << formatduration(settime) << "\n";
+        return;
+    }
+
+    // hybrid: sample the top level enumeration, weighted by the nr of combinations per skeleton.
+    std::vector<Skeleton> skeletons;
+    std::vector<double> weights;
+    for (auto& sk : skeletonshapes(0, n, L)) {
+        double w = upow(nops, sk.nops);
+        for (auto [i, j] : sk.leaves)
+            w *= size[i*(n+1)+j];
+        skeletons.push_back(sk);
+        weights.push_back(w);
+    }
+    double combos = topcost(size, n, nops, L, 0, n);
+    std::cout << "top level shapes:       " << skeletons.size() << "\n";
+    std::cout << "top level combinations: " << uint64_t(combos) << "\n";
+    if (combos == 0)
+        return;
+
+    std::discrete_distribution<int> pick(weights.begin(), weights.end());
+    std::vector<T> leafvalues(n);
+    std::vector<int> ops(n);
+    t.lap();
+    for (int k = 0 ; k < nsamples ; k++) {
+        auto& sk = skeletons[pick(rng)];
+        for (int l = 0 ; l < sk.leaves.size() ; l++) {
+            // sets which were not built: take the values from the longest built set
+            auto [i, j] = sk.leaves[l];
+            auto& set = vs.at(i, std::min(j, i+built));
+            leafvalues[l] = set[rng() % set.size()].value;
+        }
+        for (int p = 0 ; p < sk.nops ; p++)
+            ops[p] = rng() % nops;
+        sink = evalskeleton(sk, cfg.binops, leafvalues.data(), ops.data());
+    }
+    double rate = nsamples / (t.lap() / 1e6);
+    std::cout << "sample rate:            " << uint64_t(rate) << " expr/sec\n";
+    std::cout << "estimated runtime:      " << formatduration(settime + combos / rate / cfg.nthreads) << "\n";
+    (void)sink;
+}
+
+long double exacteval(const Node::ptr& t)
+{
+    auto e = std::dynamic_pointer_cast<Expr>(t);
+    if (!e)
+        return t->eval();
+    if (e->args.size() != 2)
+        return t->eval();
+    long double a = exacteval(e->args[0]);
+    long double b = exacteval(e->args[1]);
+    const auto& name = e->op->name;
+    if (name == "add") return a+b;
+    if (name == "sub") return a-b;
+    if (name == "mul") return a*b;
+    if (name == "div") return a/b;
+    if (name == "pow") return powl(a,b);
+    if (name == "cat") {
+        long double f = 1;
+        for (int i = 0 ; i < 20 && b >= f ; i++)
+            f *= 10;
+        return a*f+b;
+    }
+    return t->eval();
+}
+
+std::map<uint64_t, Node::ptr> hitset(SearchConfig cfg, const std::string& engine, int L)
+{
+    cfg.engine = engine;
+    cfg.maxlen = L;
+    cfg.collecthits = true;
+    auto e = makeengine(cfg);
+    e->prepare(cfg.nthreads);
+    e->maketasks(cfg.tasksize);
+    auto stats = runsearch(*e, cfg.nthreads, nullptr);
+    std::map<uint64_t, Node::ptr> hits;
+    for (auto& [value, expr] : stats.collected)
+        if (!std::isnan(value))
+            hits.emplace(valuebits(value), expr);
+    return hits;
+}
+
+int comparehits(const std::string& name, const std::map<uint64_t, Node::ptr>& ref, const std::map<uint64_t, Node::ptr>& hits, const std::string& trial)
+{
+    std::vector<T> values;
+    for (auto& [bits, expr] : ref)
+        values.push_back(expr->eval());
+    for (auto& [bits, expr] : hits)
+        values.push_back(expr->eval());
+    std::sort(values.begin(), values.end());
+
+    auto close = [](long double a, long double b) { return a == b || fabsl(a-b) <= 1e-9L * std::max(fabsl(a), fabsl(b)); };
+
+    int mismatches = 0, rounding = 0;
+    auto check = [&](const std::map<uint64_t, Node::ptr>& from, const std::map<uint64_t, Node::ptr>& other, const char *what) {
+        for (auto& [bits, expr] : from) {
+            if (other.count(bits))
+                continue;
+            T value = expr->eval();
+            long double exact = exacteval(expr);
+            auto p = std::lower_bound(values.begin(), values.end(), value);
+            bool nearby = false;
+            for (auto q = p == values.begin() ? p : p-1 ; q != values.end() && q <= p+1 ; q++)
+                if (!other.count(valuebits(*q)) || valuebits(*q) == bits)
+                    continue;
+                else if (close(*q, value) && close(*q, exact))
+                    nearby = true;
+            if (nearby) {
+                rounding++;
+                continue;
+            }
+            mismatches++;
+            std::cout << trial << " " << name << ": " << what << " " << value << "=" << expr << "  ( exact " << (double)exact << " )\n";
+        }
+    };
+    check(ref, hits, "missing");
+    check(hits, ref, "extra");
+    if (rounding)
+        std::cout << trial << " " << name << ": " << rounding << " rounding differences\n";
+    return mismatches;
+}
+
+int crosscheck(const SearchConfig& base, int ntrials, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    int mismatches = 0;
+    for (int trial = 0 ; trial < ntrials ; trial++) {
+        SearchConfig cfg = base;
+        int n = 2 + rng() % 4;
+        cfg.nums.clear();
+        for (int k = 0 ; k < n ; k++)
+            cfg.nums.push_back(1 + rng() % 9);
+        cfg.sequences.clear();
+        cfg.binops.clear();
+        while (cfg.binops.empty())
+            for (auto op : base.binops)
+                if (rng() % 2)
+                    cfg.binops.push_back(op);
+        cfg.isold.assign(cfg.binops.size(), false);
+        cfg.widening = false;
+        cfg.targets.clear();
+        for (int k = rng() % 3 ; k > 0 ; k--)
+            cfg.targets.push_back(rng() % 100);
+        cfg.tasksize = 1 + rng() % 256;
+        // for the lanes engine: more sequences of the same length, not a multiple of the lane count
+        std::vector<std::vector<int>> sequences{ cfg.nums };
+        for (int k = rng() % (2*LANES) ; k > 0 ; k--) {
+            sequences.emplace_back();
+            for (int i = 0 ; i < n ; i++)
+                sequences.back().push_back(1 + rng() % 9);
+        }
+
+        std::ostringstream desc;
+        desc << "trial " << trial << ": -v ";
+        for (int k = 0 ; k < n ; k++)
+            desc << (k ? "," : "") << cfg.nums[k];
+        desc << " -o ";
+        for (int k = 0 ; k < cfg.binops.size() ; k++)
+            desc << (k ? "," : "") << cfg.binops[k]->name;
+        for (auto target : cfg.targets)
+            desc << " -t " << target;
+        desc << " --tasksize " << cfg.tasksize;
+        std::ostringstream lanesdesc;
+        lanesdesc << desc.str();
+        for (int j = 1 ; j < sequences.size() ; j++) {
+            lanesdesc << " -v ";
+            for (int k = 0 ; k < n ; k++)
+                lanesdesc << (k ? "," : "") << sequences[j][k];
+        }
+
+        auto ref = hitset(cfg, "enum", 0);
+        int bad = 0;
+        for (int L = 2 ; L < n ; L++)
+            bad += comparehits("hybrid L=" + std::to_string(L), ref, hitset(cfg, "hybrid", L), desc.str());
+        bad += comparehits("hybrid", ref, hitset(cfg, "hybrid", 0), desc.str());
+        bad += comparehits("dp", ref, hitset(cfg, "dp", n), desc.str());
+        // the lanes engine finds the hits of the enum engine for each of the sequences
+        if (sequences.size() > 1) {
+            auto lanesref = ref;
+            SearchConfig seqcfg = cfg;
+            for (int j = 1 ; j < sequences.size() ; j++) {
+                seqcfg.nums = sequences[j];
+                lanesref.merge(hitset(seqcfg, "enum", 0));
+            }
+            seqcfg.nums = cfg.nums;
+            seqcfg.sequences = sequences;
+            bad += comparehits("lanes", lanesref, hitset(seqcfg, "enum", 0), lanesdesc.str());
+        }
+        if (bad)
+            std::cout << desc.str() << ": " << bad << " mismatches\n";
+        mismatches += bad;
+    }
+    std::cout << ntrials << " trials, " << mismatches << " mismatches\n";
+    return mismatches;
+}
+
+std::string tunekey(const SearchConfig& cfg)
+{
+    std::string key = "nums=";
+    for (int i = 0 ; i < cfg.nums.size() ; i++)
+        key += (i ? "," : "") + std::to_string(cfg.nums[i]);
+    key += " ops=";
+    for (int i = 0 ; i < cfg.binops.size() ; i++)
+        key += (i ? "," : "") + cfg.binops[i]->infix;
+    if (!cfg.sequences.empty())
+        key += " sequences=" + std::to_string(cfg.sequences.size());
+    return key;
+}
+
+std::string tunesettings(const SearchConfig& cfg)
+{
+    return "engine=" + cfg.engine + " L=" + std::to_string(cfg.maxlen) + " tasksize=" + std::to_string(cfg.tasksize) + " threads=" + std::to_string(cfg.nthreads);
+}
+
+void savetuning(const std::string& tunefile, const SearchConfig& cfg)
+{
+    std::vector<std::string> lines;
+    std::string key = tunekey(cfg);
+    std::ifstream in(tunefile);
+    std::string line;
+    while (std::getline(in, line))
+        if (line.compare(0, key.size()+1, key + " ") != 0)
+            lines.push_back(line);
+    in.close();
+    lines.push_back(key + " " + tunesettings(cfg));
+
+    std::ofstream outf(tunefile);
+    for (auto& l : lines)
+        outf << l << "\n";
+}
+
+bool loadtuning(const std::string& tunefile, SearchConfig& cfg)
+{
+    std::string key = tunekey(cfg);
+    std::ifstream in(tunefile);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, key.size()+1, key + " ") != 0)
+            continue;
+        for (auto kv : stringsplitter<std::string>(line.substr(key.size()+1), " ")) {
+            auto eq = kv.find('=');
+            if (eq == kv.npos)
+                continue;
+            auto name = kv.substr(0, eq);
+            auto value = kv.substr(eq+1);
+            if (name == "engine") cfg.engine = value;
+            else if (name == "L") cfg.maxlen = strtol(value.c_str(), 0, 0);
+            else if (name == "tasksize") cfg.tasksize = strtoull(value.c_str(), 0, 0);
+            else if (name == "threads") cfg.nthreads = strtol(value.c_str(), 0, 0);
+        }
+        return true;
+    }
+    return false;
+}
+
+void autotune(SearchConfig cfg, const std::string& tunefile, double tunetime)
+{
+    int n = cfg.nums.size();
+    SearchConfig best;
+    double besttime = 0;
+
+    // several sequences are only searched by the lanes engine, -e enum: tune just the task size
+    int maxL = cfg.sequences.empty() ? n : 1;
+    for (int L = 1 ; L <= maxL ; L++) {
+        // L = 1 is the enum engine
+        cfg.engine = L == 1 ? "enum" : L == n ? "dp" : "hybrid";
+        cfg.maxlen = L == 1 ? 0 : L;
+
+        timer t;
+        auto engine = makeengine(cfg);
+        engine->prepare(cfg.nthreads);
+        double preptime = t.lap() / 1e6;
+        auto hybrid = dynamic_cast<HybridEngine*>(engine.get());
+        if (hybrid && hybrid->vs.bytes() > cfg.membudget)
+            break;
+
+        for (uint64_t tasksize : { 1<<12, 1<<16, 1<<20 }) {
+            cfg.tasksize = tasksize;
+            engine->maketasks(tasksize);
+
+            // a random selection of tasks, so all shapes are represented
+            std::vector<size_t> order(engine->tasks.size());
+            for (size_t k = 0 ; k < order.size() ; k++)
+                order[k] = k;
+            std::shuffle(order.begin(), order.end(), std::mt19937_64(1));
+            auto stats = runsearch(*engine, cfg.nthreads, nullptr, order, tunetime);
+
+            double rate = stats.evaluated / stats.seconds;
+            double estimate = preptime + engine->nexpressions() / rate;
+            std::cout << tunesettings(cfg) << ": prepare " << formatduration(preptime) << ", " << uint64_t(rate) << " expr/sec, estimated runtime " << formatduration(estimate) << std::endl;
+            if (besttime == 0 || estimate < besttime) {
+                besttime = estimate;
+                best = cfg;
+            }
+        }
+        // the next level takes about 10 times longer to build
+        if (preptime > tunetime)
+            break;
+    }
+    std::cout << "best: " << tunesettings(best) << ", saved in " << tunefile << "\n";
+    savetuning(tunefile, best);
+}
+
+}   // namespace findexpr
@@ -0,0 +1,2378 @@
+/*
+
+The expression search engines, shared by the findexpr tool, the exprsearch
+library and the microbenchmarks. The definitions which are not inline are in
+exprcore.cpp, part of the exprsearch library.
+
+Author: Willem Hengeveld <itsme@xs4all.nl>
+*/
+#pragma once
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cmath>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <fstream>
+#include <condition_variable>
+#include <csignal>
+#include <cpputils/string-split.h>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <cstddef>
+#include <utility>
+#include <deque>
+#include <queue>
+#include <charconv>
+#include <bit>
+#include <stdexcept>
+#include <cerrno>
+
+// from <linux/io_uring.h>, which only exprcore.cpp includes
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace findexpr {
+
+// class for taking usec resolution time measurements, using a monotonic clock.
+struct timer {
+    using clock = std::chrono::steady_clock;
+    clock::time_point t0;
+    timer()
+        : t0(clock::now())
+    {
+    }
+    uint64_t lap()
+    {
+        auto t1 = clock::now();
+        uint64_t d = tdiff(t1, t0);
+        t0 = t1;
+        return d;
+    }
+    // usec since the last lap, without resetting
+    uint64_t elapsed() const
+    {
+        return tdiff(clock::now(), t0);
+    }
+    static uint64_t tdiff(clock::time_point lhs, clock::time_point rhs)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(lhs - rhs).count();
+    }
+};
+
+/*
+Chrome trace / Perfetto timeline of the search phases, enabled with --trace FILE.
+
+Each thread appends complete ('X') events to its own buffer, without locking,
+all buffers are written as json when the search is done.
+Load the file in chrome://tracing or https://ui.perfetto.dev
+ */
+struct TraceEvent {
+    const char *name;
+    int64_t start;          // nsec since the start of the trace
+    int64_t duration;
+    const char *argname[2];
+    int64_t arg[2];
+};
+
+struct TraceBuffer {
+    int tid;
+    std::string threadname;
+    std::vector<TraceEvent> events;
+};
+
+struct Tracer {
+    bool enabled = false;
+    timer::clock::time_point t0 = timer::clock::now();
+    std::mutex m;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+
+    int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(timer::clock::now() - t0).count();
+    }
+    TraceBuffer *newbuffer(const std::string& threadname)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        buffers.push_back(std::make_unique<TraceBuffer>());
+        auto buf = buffers.back().get();
+        buf->tid = buffers.size();
+        buf->threadname = threadname;
+        buf->events.reserve(4096);
+        return buf;
+    }
+    void write(const std::string& filename)
+    {
+        std::ofstream f(filename);
+        f << "{\"traceEvents\":[\n";
+        bool first = true;
+        char line[512];
+        for (auto& buf : buffers) {
+            snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", buf->tid, buf->threadname.c_str());
+            f << line;
+            first = false;
+            for (auto& e : buf->events) {
+                int n = snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                        e.name, buf->tid, e.start/1000.0, e.duration/1000.0);
+                for (int k = 0 ; k < 2 && e.argname[k] ; k++)
+                    n += snprintf(line+n, sizeof(line)-n, "%s\"%s\":%lld", k ? "," : "", e.argname[k], (long long)e.arg[k]);
+                snprintf(line+n, sizeof(line)-n, "}}");
+                f << line;
+            }
+        }
+        f << "\n]}\n";
+    }
+};
+
+extern Tracer tracer;
+extern thread_local TraceBuffer *tracebuf;
+
+// name the calling thread in the trace
+void tracethread(const std::string& name);
+
+// records a span from construction to destruction, when tracing is enabled
+struct TraceSpan {
+    const char *name;
+    int64_t start;
+    const char *argname[2];
+    int64_t arg[2];
+
+    TraceSpan(const char *name, const char *argname0 = nullptr, int64_t arg0 = 0, const char *argname1 = nullptr, int64_t arg1 = 0)
+        : name(name), start(tracer.enabled ? tracer.now() : 0), argname{argname0, argname1}, arg{arg0, arg1}
+    {
+    }
+    ~TraceSpan()
+    {
+        if (!tracer.enabled)
+            return;
+        if (!tracebuf)
+            tracebuf = tracer.newbuffer("thread");
+        tracebuf->events.push_back({name, start, tracer.now() - start, {argname[0], argname[1]}, {arg[0], arg[1]}});
+    }
+};
+
+/*
+Memory accounting: current and peak bytes per subsystem.
+Containers use the CountingAllocator, which reports all allocations here.
+ */
+enum MemSubsystem { MEM_TREES, MEM_VALUESETS, MEM_HASHTABLES, MEM_OUTPUT, MEM_NSUBSYSTEMS };
+extern const char *memsubsystemnames[MEM_NSUBSYSTEMS];
+
+struct MemAccount {
+    std::atomic<int64_t> current[MEM_NSUBSYSTEMS] = { };
+    std::atomic<int64_t> peak[MEM_NSUBSYSTEMS] = { };
+    std::atomic<int64_t> totalpeak = 0;
+
+    void add(int sub, int64_t bytes)
+    {
+        int64_t cur = current[sub] += bytes;
+        int64_t prev = peak[sub];
+        while (cur > prev && !peak[sub].compare_exchange_weak(prev, cur))
+            ;
+        if (bytes > 0) {
+            int64_t tot = total();
+            prev = totalpeak;
+            while (tot > prev && !totalpeak.compare_exchange_weak(prev, tot))
+                ;
+        }
+    }
+    int64_t total() const
+    {
+        int64_t tot = 0;
+        for (auto& c : current)
+            tot += c;
+        return tot;
+    }
+    // like: "trees 12345/23456 value sets 0/0 ...", current/peak bytes
+    std::string summary() const
+    {
+        std::string txt;
+        for (int k = 0 ; k < MEM_NSUBSYSTEMS ; k++)
+            txt += std::string(k ? ", " : "") + memsubsystemnames[k] + " " + std::to_string(current[k]) + "/" + std::to_string(peak[k]);
+        return txt;
+    }
+};
+
+extern MemAccount memaccount;
+
+template<typename V, int SUB>
+struct CountingAllocator {
+    using value_type = V;
+
+    CountingAllocator() = default;
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U, SUB>&) { }
+
+    template<typename U>
+    struct rebind { using other = CountingAllocator<U, SUB>; };
+
+    V *allocate(size_t n)
+    {
+        memaccount.add(SUB, n*sizeof(V));
+        return std::allocator<V>().allocate(n);
+    }
+    void deallocate(V *p, size_t n)
+    {
+        memaccount.add(SUB, -int64_t(n*sizeof(V)));
+        std::allocator<V>().deallocate(p, n);
+    }
+    template<typename U>
+    bool operator==(const CountingAllocator<U, SUB>&) const { return true; }
+    template<typename U>
+    bool operator!=(const CountingAllocator<U, SUB>&) const { return false; }
+};
+
+// the base type we do our calculations in.
+using T = double;
+
+// integer exponentiation
+inline int intpow(int a, int b)
+{
+    int r = 1;
+    while (b > 0) {
+        if (b&1)
+            r *= a;
+        a *= a;
+        b >>= 1;
+    }
+    return r;
+}
+
+// integer exponentiation, for counting large search spaces
+inline uint64_t upow(uint64_t a, int b)
+{
+    uint64_t r = 1;
+    while (b-- > 0)
+        r *= a;
+    return r;
+}
+
+
+// return 10^(trunc(log10(x))+1)
+//
+// calculates the smallest power of ten greater than x
+inline double tenfactor(double x)
+{
+    double f = 1;
+    int i=0;
+    while (i<20 && x>=f) {
+        f *= 10;
+        i++;
+    }
+    return f;
+}
+
+
+// represent an operation
+struct Operation {
+
+    // name  - the name of the operation
+    // infix - when available: a symbols for infix operator notation ( a+b, instead of add(a,b) )
+    // n     - the nr of arguments to the operation
+    // prec  - the operator precedence
+    // fn    - a lambda calculating this operation.
+    Operation( std::string name, std::string infix, int n, int prec, std::function<T(std::vector<T> args)> fn)
+        : name(name), infix(infix), n(n), precedence(prec), fn(fn), bin(nullptr)
+    {
+    }
+    // a binary operation, `bin` is used directly by the value set engines,
+    // without the overhead of the argument vector.
+    Operation( std::string name, std::string infix, int n, int prec, T(*bin)(T, T))
+        : name(name), infix(infix), n(n), precedence(prec), fn([bin](std::vector<T> args){ return bin(args[0], args[1]); }), bin(bin)
+    {
+    }
+
+    std::string name;
+    std::string infix;
+    int n;
+    int precedence;
+    std::function<T(std::vector<T> args)> fn;
+    T (*bin)(T, T);
+};
+
+// list of supported operations
+extern std::vector<Operation> oplist;
+
+inline int precedence(Operation*op)
+{
+    if (op==nullptr) // values have null.
+        return 9;
+    return op->precedence;
+}
+
+// expression tree base class
+struct Node {
+    using ptr = std::shared_ptr<Node>;
+    virtual Operation *operation() const = 0;
+    virtual T eval() const = 0;
+    virtual void output(std::ostream& os) const = 0;
+
+    friend std::ostream& operator<<(std::ostream& os, Node::ptr t)
+    {
+        t->output(os);
+        return os;
+    }
+    friend std::ostream& operator<<(std::ostream& os, const Node &t)
+    {
+        t.output(os);
+        return os;
+    }
+
+};
+
+// represent a value node
+struct Value : Node {
+    T value;
+    virtual Operation *operation() const { return nullptr; }
+    virtual T eval() const { return value; }
+    virtual void output(std::ostream& os) const { os << value; }
+
+    static auto make()
+    {
+        return std::allocate_shared<Value>(CountingAllocator<Value, MEM_TREES>());
+    }
+};
+
+// represent an expression node.
+struct Expr : Node {
+    Operation *op;
+    std::vector<Node::ptr, CountingAllocator<Node::ptr, MEM_TREES>> args;
+    Expr(Node::ptr l)
+        : op(nullptr), args{l}
+    {
+    }
+    Expr(Node::ptr l, Node::ptr r)
+        : op(nullptr), args{l, r}
+    {
+    }
+    virtual Operation *operation() const { return op; }
+    virtual T eval() const
+    {
+        std::vector<T> results;
+        for (auto v : args)
+            results.push_back(v->eval());
+        return op->fn(results);
+    }
+    virtual void output(std::ostream& os) const
+    {
+        if (!op) {
+            // no operation specified: use placeholder 'op' / '#'
+            if (args.size()==2) {
+                // binary operator
+                os << "(" << args[0] << '#' << args[1] << ")";
+            }
+            else if (args.size()==1) {
+                // unary operator
+                os << "f" << "(" << args[0] << ")";
+            }
+            else {
+                // more args: represent as function call.
+                os << "op(";
+                bool first = true;
+                for (auto arg : args)
+                {
+                    if (!first) os << ",";
+                    os << arg;
+                    first = false;
+                }
+                os << ")";
+            }
+        }
+        else if (args.size()==2 && !op->infix.empty()) {
+            // todo: num||num  -> num num
+            // todo: num||(num||num)  -> num num num
+            // todo: (num||num)||num  -> num num num
+            //
+            // (a+b) * c
+            bool needbrackets0 = precedence(op) > precedence(args[0]->operation());
+            if (needbrackets0) os << '(';
+            os << args[0];
+            if (needbrackets0) os << ')';
+
+            os << op->infix;
+
+            bool needbrackets1 = precedence(op) > precedence(args[1]->operation());
+            if (needbrackets1) os << '(';
+            os << args[1];
+            if (needbrackets1) os << ')';
+        }
+        else if (args.size()==1 && !op->infix.empty()) {
+            // render a unary operator
+            bool needbrackets0 = precedence(op) > precedence(args[0]->operation());
+            os << op->infix;
+            if (needbrackets0) os << '(';
+            os << args[0];
+            if (needbrackets0) os << ')';
+        }
+        else {
+            // render a >= 3-ary operator, or operator without infix notation.
+            os << op->name << "(";
+            bool first = true;
+            for (auto arg : args)
+            {
+                if (!first) os << ",";
+                os << arg;
+                first = false;
+            }
+            os << ")";
+        }
+    }
+    // a binary operator
+    static auto make(Node::ptr l, Node::ptr r)
+    {
+        return std::allocate_shared<Expr>(CountingAllocator<Expr, MEM_TREES>(), l, r);
+    }
+
+    // a unary operator
+    static auto make(Node::ptr l)
+    {
+        return std::allocate_shared<Expr>(CountingAllocator<Expr, MEM_TREES>(), l);
+    }
+};
+
+// a deep copy of the tree `t`, the enum engine reuses its trees for every expression.
+Node::ptr clonetree(const Node::ptr& t);
+
+// fnv-1a, with a final mix so the low bits are usable as a table index
+inline uint64_t hashstring(const std::string& s)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (unsigned char c : s)
+        h = (h ^ c) * 0x100000001b3;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    return h;
+}
+
+// the terms of a sum ( add and sub ), or the factors of a product ( mul and div ), with their sign:
+// a-(b-c) gives +a -b +c
+void collectterms(const Node::ptr& t, const std::string& plus, const std::string& minus, bool negative, std::vector<std::string>& terms);
+
+// a normal form of an expression: the same for expressions which differ only by the order
+// of the terms of sums and products, or by how they are grouped: 1+(2+3), (1+2)+3 and 3+2+1.
+std::string canonical(const Node::ptr& t);
+
+// --dedup: a set of 64 bit hashes, shared by the workers. It is split in shards, each an open
+// addressing table with its own lock, 8 bytes per slot. 0 marks an empty slot.
+struct HashSet {
+    struct Shard {
+        std::mutex m;
+        std::vector<uint64_t, CountingAllocator<uint64_t, MEM_HASHTABLES>> slots;
+        size_t count = 0;
+    };
+    static constexpr int shardbits = 6;
+    Shard shards[1<<shardbits];
+
+    // returns false when `h` was already in the set
+    bool insert(uint64_t h)
+    {
+        if (h == 0)
+            h = 1;
+        auto& s = shards[h >> (64-shardbits)];
+        std::lock_guard<std::mutex> lock(s.m);
+        if (2*(s.count+1) > s.slots.size())
+            grow(s);
+        size_t mask = s.slots.size()-1;
+        for (size_t i = h & mask ; ; i = (i+1) & mask) {
+            if (s.slots[i] == h)
+                return false;
+            if (s.slots[i] == 0) {
+                s.slots[i] = h;
+                s.count++;
+                return true;
+            }
+        }
+    }
+    void grow(Shard& s)
+    {
+        decltype(s.slots) slots(std::max(size_t(1024), 2*s.slots.size()));
+        size_t mask = slots.size()-1;
+        for (auto h : s.slots) {
+            if (h == 0)
+                continue;
+            size_t i = h & mask;
+            while (slots[i])
+                i = (i+1) & mask;
+            slots[i] = h;
+        }
+        s.slots.swap(slots);
+    }
+    size_t size()
+    {
+        size_t total = 0;
+        for (auto& s : shards) {
+            std::lock_guard<std::mutex> lock(s.m);
+            total += s.count;
+        }
+        return total;
+    }
+};
+
+// coroutine frames are recycled per thread, so creating a generator for
+// each expression does not allocate in the steady state.
+struct FramePool {
+    static constexpr size_t granule = 64;
+    static constexpr size_t nclasses = 32;     // frames up to 2KB are recycled
+    std::vector<void*> free[nclasses];
+
+    ~FramePool()
+    {
+        for (auto& list : free)
+            for (auto p : list)
+                ::operator delete(p);
+    }
+    // the size class is stored in front of the frame
+    void *allocate(size_t n)
+    {
+        size_t c = (n + sizeof(std::max_align_t) + granule-1) / granule;
+        char *p;
+        if (c < nclasses && !free[c].empty()) {
+            p = (char*)free[c].back();
+            free[c].pop_back();
+        }
+        else {
+            p = (char*)::operator new(c * granule);
+        }
+        *(size_t*)p = c;
+        return p + sizeof(std::max_align_t);
+    }
+    void release(void *frame)
+    {
+        char *p = (char*)frame - sizeof(std::max_align_t);
+        size_t c = *(size_t*)p;
+        if (c < nclasses)
+            free[c].push_back(p);
+        else
+            ::operator delete(p);
+    }
+};
+inline thread_local FramePool framepool;
+
+// a lazy sequence of values produced by a coroutine with co_yield.
+// Use it in a range for loop, or call next() for one value at a time.
+// The yielded values are not copied: they stay valid until the generator is resumed.
+template<typename V>
+class Generator {
+public:
+    struct promise_type {
+        const V *current = nullptr;
+        std::exception_ptr exception;
+
+        Generator get_return_object() { return Generator(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(const V& v) noexcept
+        {
+            current = &v;
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { exception = std::current_exception(); }
+
+        static void *operator new(size_t n) { return framepool.allocate(n); }
+        static void operator delete(void *p) { framepool.release(p); }
+    };
+    using handle = std::coroutine_handle<promise_type>;
+
+    Generator(Generator&& g)
+        : h(std::exchange(g.h, {}))
+    {
+    }
+    ~Generator()
+    {
+        if (h)
+            h.destroy();
+    }
+
+    // resume the coroutine, returns false when it has finished
+    bool advance()
+    {
+        h.resume();
+        if (h.promise().exception)
+            std::rethrow_exception(h.promise().exception);
+        return !h.done();
+    }
+    const V& value() const { return *h.promise().current; }
+
+    // the next value, throws at the end
+    V next()
+    {
+        if (!advance())
+            throw std::runtime_error("end of iteration");
+        return value();
+    }
+
+    struct iterator {
+        Generator *g;
+        bool operator!=(std::default_sentinel_t) const { return !g->h.done(); }
+        iterator& operator++() { g->advance(); return *this; }
+        const V& operator*() const { return g->value(); }
+    };
+    iterator begin() { advance(); return iterator{this}; }
+    std::default_sentinel_t end() { return {}; }
+
+private:
+    explicit Generator(handle h)
+        : h(h)
+    {
+    }
+    handle h;
+};
+
+// generate all possible binary tree shapes with n leaves.
+// The trees share their subtrees: the left subtree is reused for all right subtrees.
+Generator<Node::ptr> treeshapes(int nleaves);
+
+/*
+unary ops:
+    insert-in-tree at position
+
+tree-position:  use number to make l/r descision at each node,
+    then insert at that position
+    root -> unary -> node
+
+ */
+// the elements of `v`, which must outlive the generator
+template<typename V>
+Generator<typename V::value_type> iter(const V& v)
+{
+    for (auto& x : v)
+        co_yield x;
+}
+
+// sets leaf nodes in the tree `t` with values from the generator `g`
+template<typename GEN>
+void setvalues(Node::ptr t, GEN &g)
+{
+    auto v = std::dynamic_pointer_cast<Value>(t);
+    if (v) {
+        v->value = g.next();
+        return;
+    }
+    auto e =  std::dynamic_pointer_cast<Expr>(t);
+    if (e) {
+        for (auto a : e->args)
+            setvalues(a, g);
+    }
+}
+
+// sets expression nodes in the tree `t` with binary operations from the generator `g`
+template<typename GEN>
+void setops(Node::ptr t, GEN &g)
+{
+    auto e =  std::dynamic_pointer_cast<Expr>(t);
+    if (e) {
+        if (e->args.size()==2)
+            e->op = g.next();
+        for (auto a : e->args)
+            setops(a, g);
+    }
+}
+
+// generate operations given the index number `i`.
+// use i as a n-ary number, each digit choosing an operation
+// from the `ops` list.
+Generator<Operation*> opsgenerator(const std::vector<Operation*>& ops, uint64_t i);
+
+// an assignment of operations to the operation slots of a tree, in setops order
+struct OpAssignment {
+    uint64_t index;
+    std::vector<Operation*> ops;
+};
+
+// the op assignments [first, last) for `nslots` operations: slot k has digit k of the index.
+// The assignment is updated in place, like an odometer. With `isold`, -w, the assignments
+// using only old operations are skipped.
+Generator<OpAssignment> opassignments(const std::vector<Operation*>& binops, int nslots, uint64_t first, uint64_t last, std::vector<bool> isold = {});
+
+// find a binary operation by name or by infix symbol
+Operation *findbinop(const std::string& name);
+
+// parse a comma separated list of binary operations, like "+,-,*,/" or "add,cat"
+bool parseops(const std::string& spec, std::vector<Operation*>& ops);
+
+// tests if the op assignment with index `i` uses at least one operation
+// not marked in `isold`. Used to skip assignments which were already searched
+// in a previous run with a smaller operation set.
+inline bool usesnewop(const std::vector<bool>& isold, int nops, uint64_t i)
+{
+    for (int j = 0 ; j < nops ; j++) {
+        if (!isold[i % isold.size()])
+            return true;
+        i /= isold.size();
+    }
+    return false;
+}
+
+// the first assignment index >= i which uses a new operation, or nops^nslots when there is none.
+// Jumps over the ranges of old only assignments, without testing each of them.
+inline uint64_t nextnewassignment(const std::vector<bool>& isold, int nslots, uint64_t i)
+{
+    uint64_t n = isold.size();
+    uint64_t total = upow(n, nslots);
+    if (i >= total || usesnewop(isold, nslots, i))
+        return i;
+    if (nslots == 0)
+        return total;
+    // all slots old: a new op in the lowest slot, keeping the higher slots
+    for (uint64_t d = i % n + 1 ; d < n ; d++)
+        if (!isold[d])
+            return i - i % n + d;
+    // or the next value of the higher slots, with the first new op in the lowest slot when those are all old
+    uint64_t high = i / n + 1;
+    if (high * n >= total)
+        return total;
+    if (usesnewop(isold, nslots-1, high))
+        return high * n;
+    for (uint64_t d = 0 ; d < n ; d++)
+        if (!isold[d])
+            return high * n + d;
+    return total;
+}
+
+// the parameters of a search
+struct SearchConfig {
+    std::vector<int> nums;
+    std::vector<std::vector<int>> sequences;   // several sequences of the same length, searched at once by the enum engine
+    std::vector<Operation*> binops;
+    std::vector<bool> isold;       // per binop: already searched in a previous run
+    bool widening = false;
+    std::vector<int> targets;      // empty: every value is a hit
+
+    std::string engine = "enum";
+    int maxlen = 0;                // hybrid: max interval length of the value sets, 0: cost model
+    size_t membudget = size_t(1024)<<20;
+    size_t maxmemory = 0;          // hard limit for all accounted memory, 0: none
+    int nthreads = 1;
+    uint64_t tasksize = 1<<16;     // nr of expressions per task
+
+    bool profile = false;          // collect per shape and per operation statistics
+    bool perfcounters = false;     // measure hardware performance counters per worker
+    bool memstats = false;         // report memory use per subsystem at exit
+    bool summary = false;          // print a machine readable summary line on stderr
+    bool collecthits = false;      // return all hits in SearchStats::collected
+    double progress = 0;           // seconds between progress reports, 0: none
+    std::string metricsfile;       // rewritten with the current metrics every progress interval
+    std::string tracefile;         // chrome trace json output
+    bool ordered = false;          // write the results in task order, independent of the threads
+    bool numa = false;             // pin the workers spread over the NUMA nodes, with node local data
+    bool dedup = false;            // report only one expression of each canonical form
+    int distinct = 0;              // 1: write the sorted distinct values of the hits, 2: with an expression each
+    size_t sortmemory = size_t(1024)<<20;  // --distinct: memory for the sort buffers, beyond that runs are written to tmpdir
+    std::string tmpdir = "/tmp";
+    int uring = 0;                 // write the output with this many writes in flight, 0: through std::cout
+    size_t uringbuffer = size_t(1)<<20;    // --uring: bytes per output buffer
+    bool estimate = false;         // estimate the nr of distinct values of the hits, instead of printing them
+    uint64_t coverage = 0;         // report which integers in [0, coverage) are hits, instead of printing them
+    bool pipeline = false;         // format and write the hits on separate threads
+    int formatthreads = 1;         // --pipeline: nr of threads formatting hits
+    size_t batchsize = 1024;       // --pipeline: nr of hits per batch
+    size_t queuesize = 64;         // --pipeline: nr of batches in each queue
+
+    bool ishit(T result) const
+    {
+        if (targets.empty())
+            return true;
+        for (auto target : targets)
+            if (fabs(result-target)<=0.11)
+                return true;
+        return false;
+    }
+};
+
+std::string formatduration(double sec);
+
+/*
+--uring: output written from `depth` buffers, with several writes in flight, so the search
+does not wait for each write. On linux the writes go through io_uring, with the buffers
+registered with the kernel, using the raw syscalls. When io_uring is not available, like
+in containers which block it, the buffers are written with write(2) when they are full.
+
+Regular files get explicit offsets, so writes can complete in any order. Pipes, terminals
+and files opened for appending are written one buffer at a time, to keep the order.
+ */
+struct AsyncWriter {
+    int fd;
+    size_t buffersize;
+    int depth;
+    std::vector<char*> buffers;
+    std::vector<size_t> fill;          // bytes in each buffer
+    std::vector<int64_t> offsets;      // the file offset of each buffer in flight
+    std::vector<int> freebuffers;
+    int cur = -1;                      // the buffer being filled
+    int64_t offset = -1;               // the next file offset, -1 when not seekable
+
+    // statistics
+    const char *backend = "write(2)";
+    uint64_t bytes = 0;
+    uint64_t writes = 0;
+    uint64_t depthsum = 0;             // the sum of the nr of writes in flight at each submit
+    int maxdepth = 0;
+    int inflight = 0;
+    uint64_t waitusec = 0;             // time spent waiting for a free buffer, or in write(2)
+    timer t;
+
+    // the io_uring, ringfd stays -1 when it is not available
+    int ringfd = -1;
+    bool fixed = false;                // the buffers are registered
+    void *sqmap = nullptr, *cqmap = nullptr;
+    size_t sqmapsize = 0, cqmapsize = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesize = 0;
+    unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    io_uring_cqe *cqes;
+
+    AsyncWriter(int fd, int depth, size_t buffersize);
+    ~AsyncWriter();
+
+    void setupring();
+    void submitring(int b);
+    // stop using the ring, after collecting the writes in flight. Writes which can not be
+    // collected are written again, at the same offset. `except` is a buffer not yet submitted.
+    void closering(int except);
+    // handle completed writes, when `wait` is set wait for at least one.
+    // Returns false when waiting failed.
+    bool reap(bool wait);
+    // write buffer `b` from position `done`, and make it free again
+    void writeall(int b, size_t done);
+    void submit(int b);
+    int getbuffer();
+    void write(const char *p, size_t n)
+    {
+        while (n) {
+            if (cur < 0)
+                cur = getbuffer();
+            size_t chunk = std::min(n, buffersize - fill[cur]);
+            memcpy(buffers[cur] + fill[cur], p, chunk);
+            fill[cur] += chunk;
+            p += chunk;
+            n -= chunk;
+            if (fill[cur] == buffersize) {
+                submit(cur);
+                cur = -1;
+            }
+        }
+    }
+    // write the last buffer, and wait for all writes
+    void finish();
+    std::string report();
+};
+
+// collects the output of the worker threads
+struct Output {
+    std::mutex m;
+    std::unique_ptr<AsyncWriter> async;    // --uring
+
+    void write(const std::string& s)
+    {
+        TraceSpan span("output flush", "bytes", s.size());
+        std::lock_guard<std::mutex> lock(m);
+        if (async)
+            async->write(s.data(), s.size());
+        else
+            std::cout << s << std::flush;
+    }
+    // wait for the writes in flight
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (async)
+            async->finish();
+    }
+};
+
+// --ordered: the output of each task is written in task order, whatever thread ran it.
+// Tasks more than `window` positions ahead of the next one to write have to wait,
+// which bounds the amount of buffered output.
+struct ReorderBuffer {
+    // a hit in the output of a task, with the hash of its canonical form, for --dedup
+    struct HitSpan {
+        uint64_t hash;
+        size_t begin;
+        size_t end;
+    };
+    struct TaskOutput {
+        std::string text;
+        std::vector<HitSpan> spans;
+    };
+    Output *out;
+    size_t window;
+    std::function<std::string(size_t)> trailer;   // text written after a task, like the end of a shape
+    HashSet *dedup = nullptr;  // --dedup: decided here, in task order, so the output does not depend on the threads
+    uint64_t duplicates = 0;
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::map<size_t, TaskOutput> pending;
+    size_t next = 0;           // the next task position to write
+
+    ReorderBuffer(Output *out, size_t window, std::function<std::string(size_t)> trailer)
+        : out(out), window(window), trailer(trailer)
+    {
+    }
+    // wait until task `pos` is within the window
+    void waitfor(size_t pos)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&]() { return pos < next + window; });
+    }
+    // the text of a task, without the hits which were already written
+    std::string dropduplicates(const TaskOutput& t)
+    {
+        std::string kept;
+        size_t done = 0;
+        for (auto& span : t.spans) {
+            kept.append(t.text, done, span.begin - done);
+            if (dedup->insert(span.hash))
+                kept.append(t.text, span.begin, span.end - span.begin);
+            else
+                duplicates++;
+            done = span.end;
+        }
+        kept.append(t.text, done, std::string::npos);
+        return kept;
+    }
+    // the output of task `pos`, written when all earlier tasks are written
+    void put(size_t pos, std::string text, std::vector<HitSpan> spans)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        memaccount.add(MEM_OUTPUT, text.size());
+        pending.emplace(pos, TaskOutput{ std::move(text), std::move(spans) });
+        bool advanced = false;
+        while (!pending.empty() && pending.begin()->first == next) {
+            auto& t = pending.begin()->second;
+            memaccount.add(MEM_OUTPUT, -int64_t(t.text.size()));
+            std::string s = dedup ? dropduplicates(t) : std::move(t.text);
+            s += trailer(next);
+            if (!s.empty())
+                out->write(s);
+            pending.erase(pending.begin());
+            next++;
+            advanced = true;
+        }
+        if (advanced)
+            cv.notify_all();
+    }
+};
+
+/*
+A compressed set of 32 bit integers, like a roaring bitmap: the integers are split in blocks of 64K
+by their high 16 bits. A block with up to 4096 integers is a sorted array of their low 16 bits,
+a fuller block is a bitmap of 1024 words, so no block takes more than 8 kB.
+Union and intersection work per block, on whole words where both blocks are bitmaps.
+ */
+struct IntBitmap {
+    static constexpr uint32_t maxsparse = 4096;
+    struct Block {
+        std::vector<uint16_t, CountingAllocator<uint16_t, MEM_VALUESETS>> sparse;   // sorted, when dense is empty
+        std::vector<uint64_t, CountingAllocator<uint64_t, MEM_VALUESETS>> dense;    // 1024 words, or empty
+        uint32_t count = 0;
+
+        bool contains(uint16_t lo) const
+        {
+            if (!dense.empty())
+                return (dense[lo>>6] >> (lo&63)) & 1;
+            return std::binary_search(sparse.begin(), sparse.end(), lo);
+        }
+        void add(uint16_t lo)
+        {
+            if (!dense.empty()) {
+                uint64_t bit = uint64_t(1) << (lo&63);
+                if (!(dense[lo>>6] & bit)) {
+                    dense[lo>>6] |= bit;
+                    count++;
+                }
+                return;
+            }
+            auto i = std::lower_bound(sparse.begin(), sparse.end(), lo);
+            if (i != sparse.end() && *i == lo)
+                return;
+            sparse.insert(i, lo);
+            count++;
+            if (count > maxsparse)
+                todense();
+        }
+        void todense()
+        {
+            dense.assign(1024, 0);
+            for (auto lo : sparse)
+                dense[lo>>6] |= uint64_t(1) << (lo&63);
+            sparse.clear();
+            sparse.shrink_to_fit();
+        }
+        // after the bitmap changed: recount, and go back to an array when that is smaller
+        void recount()
+        {
+            count = 0;
+            for (auto w : dense)
+                count += std::popcount(w);
+            if (count > maxsparse)
+                return;
+            sparse.clear();
+            for (uint32_t k = 0 ; k < 1024 ; k++)
+                for (uint64_t w = dense[k] ; w ; w &= w-1)
+                    sparse.push_back(k*64 + std::countr_zero(w));
+            dense.clear();
+            dense.shrink_to_fit();
+        }
+        // the first integer >= lo which is not in the block, 0x10000 when there is none
+        uint32_t firstmissing(uint32_t lo) const
+        {
+            if (!dense.empty()) {
+                for (uint32_t k = lo>>6 ; k < 1024 ; k++) {
+                    uint64_t free = ~dense[k];
+                    if (k == lo>>6)
+                        free &= ~uint64_t(0) << (lo&63);
+                    if (free)
+                        return k*64 + std::countr_zero(free);
+                }
+                return 0x10000;
+            }
+            for (auto i = std::lower_bound(sparse.begin(), sparse.end(), lo) ; i != sparse.end() && *i == lo ; ++i)
+                lo++;
+            return lo;
+        }
+    };
+    std::map<uint32_t, Block> blocks;      // by the high 16 bits
+    Block *lastblock = nullptr;            // the block of the last add, most adds go to the same block
+    uint32_t lasthi = 0;
+
+    void add(uint32_t v)
+    {
+        if (!lastblock || lasthi != v>>16) {
+            lasthi = v>>16;
+            lastblock = &blocks[lasthi];
+        }
+        lastblock->add(v & 0xFFFF);
+    }
+    bool contains(uint32_t v) const
+    {
+        auto i = blocks.find(v>>16);
+        return i != blocks.end() && i->second.contains(v & 0xFFFF);
+    }
+    // all integers in [first, last)
+    void addrange(uint64_t first, uint64_t last)
+    {
+        while (first < last) {
+            auto& b = blocks[first>>16];
+            uint64_t end = std::min(last, ((first>>16)+1)<<16);
+            if (b.dense.empty())
+                b.todense();
+            for (uint64_t v = first ; v < end ; v++)
+                b.dense[(v>>6)&1023] |= uint64_t(1) << (v&63);
+            b.recount();
+            first = end;
+        }
+    }
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (auto& [hi, b] : blocks)
+            total += b.count;
+        return total;
+    }
+    // add all integers of `other`
+    void unite(const IntBitmap& other)
+    {
+        for (auto& [hi, ob] : other.blocks) {
+            auto& b = blocks[hi];
+            if (b.count == 0) {
+                b = ob;
+                continue;
+            }
+            if (ob.dense.empty() && b.dense.empty() && b.count + ob.count <= maxsparse) {
+                decltype(b.sparse) merged;
+                std::set_union(b.sparse.begin(), b.sparse.end(), ob.sparse.begin(), ob.sparse.end(), std::back_inserter(merged));
+                b.sparse.swap(merged);
+                b.count = b.sparse.size();
+                continue;
+            }
+            if (b.dense.empty())
+                b.todense();
+            if (!ob.dense.empty())
+                for (int k = 0 ; k < 1024 ; k++)
+                    b.dense[k] |= ob.dense[k];
+            else
+                for (auto lo : ob.sparse)
+                    b.dense[lo>>6] |= uint64_t(1) << (lo&63);
+            b.recount();
+        }
+        lastblock = nullptr;
+    }
+    // keep only the integers which are also in `other`
+    void intersect(const IntBitmap& other)
+    {
+        for (auto i = blocks.begin() ; i != blocks.end() ; ) {
+            auto o = other.blocks.find(i->first);
+            auto& b = i->second;
+            if (o != other.blocks.end() && !b.dense.empty() && !o->second.dense.empty()) {
+                for (int k = 0 ; k < 1024 ; k++)
+                    b.dense[k] &= o->second.dense[k];
+                b.recount();
+            }
+            else if (o != other.blocks.end()) {
+                // at least one side is an array: test its entries against the other side
+                auto& small = b.dense.empty() ? b : o->second;
+                auto& large = b.dense.empty() ? o->second : b;
+                decltype(b.sparse) kept;
+                for (auto lo : small.sparse)
+                    if (large.contains(lo))
+                        kept.push_back(lo);
+                b.dense.clear();
+                b.sparse.swap(kept);
+                b.count = b.sparse.size();
+            }
+            if (o == other.blocks.end() || b.count == 0)
+                i = blocks.erase(i);
+            else
+                ++i;
+        }
+        lastblock = nullptr;
+    }
+    // the first integer >= v which is not in the set, 2^32 when there is none
+    uint64_t firstmissing(uint64_t v) const
+    {
+        while (v < (uint64_t(1)<<32)) {
+            auto i = blocks.find(v>>16);
+            if (i == blocks.end())
+                return v;
+            uint32_t lo = i->second.firstmissing(v & 0xFFFF);
+            if (lo < 0x10000)
+                return (v & ~uint64_t(0xFFFF)) + lo;
+            v = ((v>>16)+1) << 16;
+        }
+        return v;
+    }
+};
+
+// a HyperLogLog sketch: estimates the nr of distinct 64 bit hashes added, using 2^p one byte
+// registers, with a standard error of 1.04/sqrt(2^p). Sketches merge by taking the register maxima.
+struct HyperLogLog {
+    int p;
+    std::vector<uint8_t> reg;
+
+    HyperLogLog(int p)
+        : p(p), reg(size_t(1)<<p)
+    {
+    }
+    void add(uint64_t h)
+    {
+        size_t idx = h >> (64-p);
+        uint8_t rank = std::countl_zero((h << p) | (uint64_t(1) << (p-1))) + 1;
+        if (rank > reg[idx])
+            reg[idx] = rank;
+    }
+    void merge(const HyperLogLog& other)
+    {
+        for (size_t k = 0 ; k < reg.size() ; k++)
+            reg[k] = std::max(reg[k], other.reg[k]);
+    }
+    double estimate() const
+    {
+        double m = reg.size();
+        double sum = 0;
+        int zeros = 0;
+        for (auto r : reg) {
+            sum += std::ldexp(1.0, -r);
+            if (r == 0)
+                zeros++;
+        }
+        double e = 0.7213/(1+1.079/m) * m*m / sum;
+        // small cardinalities: linear counting
+        if (e <= 2.5*m && zeros)
+            e = m * std::log(m/zeros);
+        return e;
+    }
+    double error() const { return 1.04 / std::sqrt(double(reg.size())); }
+};
+
+/*
+--estimate: the nr of distinct values of the hits, overall and per range of integers,
+from HyperLogLog sketches, a few tens of kilobytes per worker, merged at the end.
+Values are distinguished by their bit pattern, like in the value sets.
+ */
+struct DistinctEstimate {
+    enum { FRACTIONS, NEGATIVE, DIGITS1, HUGE = DIGITS1 + 16, NRANGES };
+    HyperLogLog all{14};
+    std::vector<HyperLogLog> ranges;
+
+    DistinctEstimate()
+        : ranges(NRANGES, HyperLogLog(10))
+    {
+    }
+    // the range of a finite value: fractions, negative integers, or the nr of digits of an integer
+    static int range(T v)
+    {
+        if (v != std::floor(v))
+            return FRACTIONS;
+        if (v < 0)
+            return NEGATIVE;
+        int digits = 1;
+        for (double limit = 10 ; v >= limit && digits <= 16 ; limit *= 10)
+            digits++;
+        return DIGITS1 + digits - 1;
+    }
+    static std::string rangename(int r)
+    {
+        if (r == FRACTIONS)
+            return "non-integers";
+        if (r == NEGATIVE)
+            return "negative integers";
+        if (r == HUGE)
+            return "integers >= 1e16";
+        if (r == DIGITS1)
+            return "0 .. 9";
+        return "1e" + std::to_string(r - DIGITS1) + " .. 1e" + std::to_string(r - DIGITS1 + 1) + "-1";
+    }
+    void add(T v)
+    {
+        if (std::isnan(v))
+            return;
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        // the bit patterns of small integers differ only in the high bits: mix them
+        bits ^= bits >> 31;
+        bits *= 0xbf58476d1ce4e5b9;
+        bits ^= bits >> 29;
+        bits *= 0x94d049bb133111eb;
+        bits ^= bits >> 32;
+        all.add(bits);
+        if (std::isfinite(v))
+            ranges[range(v)].add(bits);
+    }
+    void merge(const DistinctEstimate& other)
+    {
+        all.merge(other.all);
+        for (int r = 0 ; r < NRANGES ; r++)
+            ranges[r].merge(other.ranges[r]);
+    }
+};
+
+/*
+--distinct: the sorted list of the distinct values of the hits, optionally with one expression each.
+Each worker collects its hits in its own buffer. A full buffer is sorted and made unique, and when that
+does not free enough, written to a temporary run file. At the end each worker sorts its buffer, then
+the buffers and the run files are merged.
+Of equal values the expression which sorts first is kept, so the output does not depend on the threads.
+ */
+struct DistinctValues {
+    struct Item {
+        T value;
+        std::string expr;
+
+        bool operator<(const Item& rhs) const { return value < rhs.value || (value == rhs.value && expr < rhs.expr); }
+        bool operator>(const Item& rhs) const { return rhs < *this; }
+    };
+    struct Buffer {
+        std::vector<Item, CountingAllocator<Item, MEM_OUTPUT>> items;
+        size_t bytes = 0;
+    };
+    bool withexpr;
+    size_t limit;                  // bytes per worker buffer
+    std::string tmpdir;
+    std::vector<Buffer> buffers;
+
+    std::mutex m;
+    std::vector<FILE*> runs;       // sorted run files, already unlinked
+    uint64_t spilled = 0;          // nr of values written to run files
+
+    DistinctValues(int nworkers, bool withexpr, size_t memory, const std::string& tmpdir);
+    ~DistinctValues();
+    static size_t itembytes(const Item& item) { return sizeof(Item) + item.expr.size(); }
+
+    // called by worker `w` for each hit
+    void add(int w, T value, const Node::ptr& expr);
+    // sort, and keep the first item of each value
+    void compact(Buffer& b);
+    FILE *createrun();
+    // write the sorted buffer to a run file: value, expression length, expression
+    void spill(Buffer& b);
+    static bool readitem(FILE *f, Item& item);
+
+    // called by each worker when it is done
+    void finish(int w);
+
+    // merge the worker buffers and the run files, writing each value once, in the
+    // shortest form which reads back as the same double. Returns the nr of distinct values.
+    uint64_t write(Output& out);
+};
+
+// a bounded queue between pipeline stages: push waits while it is full, pop waits
+// while it is empty, and returns false when all producers are done.
+template<typename B>
+struct BatchQueue {
+    std::mutex m;
+    std::condition_variable notempty;
+    std::condition_variable notfull;
+    std::deque<B> q;
+    size_t capacity;
+    int producers;             // nr of producers which did not close yet
+    uint64_t fullwaits = 0;    // nr of pushes which waited for the consumers
+
+    BatchQueue(size_t capacity, int producers)
+        : capacity(capacity), producers(producers)
+    {
+    }
+    void push(B b)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        if (q.size() >= capacity) {
+            fullwaits++;
+            notfull.wait(lock, [&]() { return q.size() < capacity; });
+        }
+        q.push_back(std::move(b));
+        notempty.notify_one();
+    }
+    bool pop(B& b)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        notempty.wait(lock, [&]() { return !q.empty() || producers == 0; });
+        if (q.empty())
+            return false;
+        b = std::move(q.front());
+        q.pop_front();
+        notfull.notify_one();
+        return true;
+    }
+    // called by each producer when it is done
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (--producers == 0)
+            notempty.notify_all();
+    }
+};
+
+// hits of one worker, with a copy of their expression, followed by a line of text, like the end of a shape
+struct HitBatch {
+    std::vector<std::pair<T, Node::ptr>> hits;
+    std::string text;
+};
+
+/*
+--pipeline: the hits go through separate stages, connected by bounded queues of batches:
+
+    evaluate ( the workers ) -> format ( `nformatters` threads ) -> write ( one thread )
+
+so formatting and writing the output does not stall the evaluation, until the queues are full.
+Generating the expressions stays in the workers: the generators update the trees in place.
+ */
+struct Pipeline {
+    Output *out;
+    BatchQueue<HitBatch> hits;
+    BatchQueue<std::string> text;
+    std::vector<std::thread> threads;
+
+    Pipeline(Output *out, int nworkers, int nformatters, size_t queuesize)
+        : out(out), hits(queuesize, nworkers), text(queuesize, nformatters)
+    {
+        for (int k = 0 ; k < nformatters ; k++)
+            threads.emplace_back([this, k]() {
+                    tracethread("format " + std::to_string(k));
+                    format();
+                });
+        threads.emplace_back([this]() {
+                tracethread("write");
+                write();
+            });
+    }
+    // waits until all workers closed the hit queue, and all output is written
+    ~Pipeline()
+    {
+        for (auto& th : threads)
+            th.join();
+    }
+    void format()
+    {
+        HitBatch b;
+        while (hits.pop(b)) {
+            TraceSpan span("format", "hits", b.hits.size());
+            std::ostringstream os;
+            for (auto& [value, expr] : b.hits)
+                os << value << '=' << expr << '\n';
+            os << b.text;
+            text.push(os.str());
+        }
+        text.close();
+    }
+    void write()
+    {
+        std::string s;
+        while (text.pop(s))
+            if (!s.empty())
+                out->write(s);
+    }
+};
+
+/*
+The cpus this process may use, and their NUMA nodes, from sysfs and the cpu affinity mask.
+The affinity mask reflects cgroup cpusets, a cgroup cpu quota limits the default thread count.
+ */
+struct Topology {
+    std::vector<int> cpus;         // allowed cpus
+    std::vector<int> cpunode;      // the node index for each allowed cpu, 0 .. nnodes-1
+    int nnodes = 1;
+    int quota = 0;                 // cgroup cpu quota in whole cpus, 0: none
+
+    // parse a sysfs cpu list like "0-3,8,10-11"
+    static std::vector<int> parsecpulist(const std::string& text);
+
+    static Topology detect(const std::string& sysfs = "/sys");
+
+    // the default nr of worker threads
+    int defaultthreads() const
+    {
+        int n = cpus.size();
+        return quota ? std::min(n, quota) : n;
+    }
+
+    // the cpu for each of `nworkers` workers: the workers are spread round robin over
+    // the nodes, and over the cpus within a node.
+    std::vector<int> placement(int nworkers) const;
+    int nodeof(int cpu) const;
+};
+
+// the topology of this machine, detected once
+const Topology& topology();
+
+// pin the calling thread to `cpu`, returns false when that is not possible
+bool pinthread(int cpu);
+
+/*
+Hardware performance counters for the calling thread, using perf_event_open.
+Each counter is opened separately, so the ones which are available are still
+reported when others are not, like in most virtual machines.
+Counts are scaled when the kernel had to multiplex the counters.
+ */
+struct PerfCounters {
+    enum { CYCLES, INSTRUCTIONS, BRANCHMISSES, CACHEMISSES, TASKCLOCK, NCOUNTERS };
+
+    int fds[NCOUNTERS] = { -1, -1, -1, -1, -1 };
+    uint64_t values[NCOUNTERS] = { };
+    bool valid[NCOUNTERS] = { };
+
+    static int openevent(uint32_t type, uint64_t config);
+    // open and start the counters for the calling thread
+    void start();
+    // stop the counters, and read their values
+    void stop();
+};
+
+// --profile statistics for one shape
+struct ShapeProfile {
+    uint64_t usec = 0;
+    uint64_t evaluated = 0;
+    uint64_t nan = 0;
+    uint64_t inf = 0;
+    uint64_t hits = 0;
+};
+
+// hooks for embedding the search in another program, used by the exprsearch library.
+struct SearchHooks {
+    // called from the worker threads for each hit
+    std::function<void(T, const Node::ptr&)> onhit;
+    // called from the monitor thread every `progressinterval` seconds, and once at the end
+    std::function<void(uint64_t done, uint64_t total, uint64_t evaluated, uint64_t hits, double seconds)> onprogress;
+    double progressinterval = 1;
+    // the workers stop taking new tasks when this is set
+    const std::atomic<bool> *cancel = nullptr;
+
+    bool cancelled() const { return cancel && *cancel; }
+};
+
+// the state of one worker thread
+struct Worker {
+    int id;
+    Output *out;               // nullptr: results are counted, but not printed
+    std::ostringstream os;
+    int64_t buffered = 0;      // bytes in os, as accounted in memaccount
+    uint64_t evaluated = 0;
+    uint64_t hits = 0;
+    uint64_t tasks = 0;
+    uint64_t steals = 0;
+    uint64_t done = 0;         // the nr of expressions in completed tasks
+    uint64_t busyusec = 0;     // time spent running tasks, the rest of the search is idle time
+    int node = 0;              // --numa: the node this worker is pinned to
+    uint64_t remotesteals = 0; // steals from a worker on another node
+
+    const SearchHooks *hooks = nullptr;
+    ReorderBuffer *reorder = nullptr;      // --ordered: output is handed over per task
+    std::vector<ReorderBuffer::HitSpan> spans;     // --ordered with --dedup: the hits in os
+    Pipeline *pipeline = nullptr;          // --pipeline: hits are handed over in batches
+    HashSet *dedup = nullptr;              // --dedup: the canonical forms already reported
+    DistinctValues *distinct = nullptr;    // --distinct: the hits are collected, not printed
+    std::unique_ptr<DistinctEstimate> estimate;    // --estimate: this worker's sketches
+    std::unique_ptr<IntBitmap> reached;            // --coverage: the non negative integer hits of this worker
+    uint64_t duplicates = 0;               // hits not reported, because of --dedup
+    HitBatch batch;
+    size_t batchsize = 1024;
+
+    // --crosscheck: keep a copy of all hits
+    bool collecting = false;
+    std::vector<std::pair<T, Node::ptr>> collected;
+
+    // copies of the counters, published after each task, read by the progress monitor
+    std::atomic<uint64_t> pubevaluated = 0;
+    std::atomic<uint64_t> pubhits = 0;
+    std::atomic<uint64_t> pubtasks = 0;
+    std::atomic<uint64_t> pubsteals = 0;
+    std::atomic<uint64_t> pubdone = 0;
+
+    PerfCounters perf;
+
+    // --profile: per shape, and per operation: the nr of finite results and hits it was used in.
+    bool profiling = false;
+    std::vector<ShapeProfile> shapeprof;
+    std::vector<uint64_t> opvalid;
+    std::vector<uint64_t> ophits;
+
+    Worker(int id, Output *out)
+        : id(id), out(out)
+    {
+    }
+    void startprofile(int nshapes, int nops)
+    {
+        profiling = true;
+        shapeprof.resize(nshapes);
+        opvalid.resize(nops);
+        ophits.resize(nops);
+    }
+    // count a result for the profile, returns true for finite results
+    bool profile(int shape, T result, bool hit)
+    {
+        auto& sp = shapeprof[shape];
+        sp.evaluated++;
+        if (std::isnan(result)) {
+            sp.nan++;
+            return false;
+        }
+        if (std::isinf(result)) {
+            sp.inf++;
+            return false;
+        }
+        if (hit)
+            sp.hits++;
+        return true;
+    }
+    void countop(int op, bool hit)
+    {
+        opvalid[op]++;
+        if (hit)
+            ophits[op]++;
+    }
+    void report(T result, const Node::ptr& expr)
+    {
+        // --ordered: duplicates are dropped by the reorder buffer, in task order
+        uint64_t hash = 0;
+        if (dedup) {
+            hash = hashstring(canonical(expr));
+            if (!reorder && !dedup->insert(hash)) {
+                duplicates++;
+                return;
+            }
+        }
+        hits++;
+        if (collecting)
+            collected.emplace_back(result, clonetree(expr));
+        if (hooks && hooks->onhit)
+            hooks->onhit(result, expr);
+        if (distinct)
+            distinct->add(id, result, expr);
+        if (estimate)
+            estimate->add(result);
+        if (reached && result >= 0 && result < 4294967296.0 && result == std::floor(result))
+            reached->add(uint32_t(result));
+        if (!out)
+            return;
+        if (pipeline) {
+            batch.hits.emplace_back(result, clonetree(expr));
+            if (batch.hits.size() >= batchsize)
+                flush();
+            return;
+        }
+        size_t begin = os.tellp();
+        os << result << '=' << expr << '\n';
+        int64_t size = os.tellp();
+        if (reorder && dedup)
+            spans.push_back(ReorderBuffer::HitSpan{ hash, begin, size_t(size) });
+        memaccount.add(MEM_OUTPUT, size - buffered);
+        buffered = size;
+        if (size > 0x10000 && !reorder)
+            flush();
+    }
+    // hand the output of task `pos` to the reorder buffer
+    void submit(size_t pos)
+    {
+        reorder->put(pos, os.str(), std::move(spans));
+        spans.clear();
+        os.str("");
+        memaccount.add(MEM_OUTPUT, -buffered);
+        buffered = 0;
+    }
+    // the current batch of hits, followed by `text`, goes to the pipeline
+    void handover(std::string text)
+    {
+        batch.text = std::move(text);
+        pipeline->hits.push(std::move(batch));
+        batch = HitBatch();
+    }
+    void flush()
+    {
+        if (pipeline && !batch.hits.empty())
+            handover("");
+        if (out && os.tellp() > 0) {
+            out->write(os.str());
+            os.str("");
+            memaccount.add(MEM_OUTPUT, -buffered);
+            buffered = 0;
+        }
+    }
+    void publish()
+    {
+        pubevaluated.store(evaluated, std::memory_order_relaxed);
+        pubhits.store(hits, std::memory_order_relaxed);
+        pubtasks.store(tasks, std::memory_order_relaxed);
+        pubsteals.store(steals, std::memory_order_relaxed);
+        pubdone.store(done, std::memory_order_relaxed);
+    }
+};
+
+// a unit of work: a range of op assignments, or set entry combinations, of one shape.
+struct Task {
+    int shape;
+    uint64_t first;
+    uint64_t last;
+};
+
+// a search engine splits the search in tasks, which are run by the worker threads.
+struct Engine {
+    const SearchConfig& cfg;
+    std::vector<std::string> shapenames;   // shown in the '=====' line when a shape is done
+    std::vector<uint64_t> shapesizes;      // the nr of expressions for each shape
+    std::vector<Task> tasks;
+
+    Engine(const SearchConfig& cfg)
+        : cfg(cfg)
+    {
+    }
+    virtual ~Engine() { }
+
+    // prepare for running with `nworkers` threads, and list the shapes.
+    virtual void prepare(int nworkers) = 0;
+    virtual void runtask(const Task& task, Worker& w) = 0;
+
+    // a description of the preparation, printed before the search starts
+    virtual std::string info() const { return ""; }
+
+    // split the expressions of each shape in tasks of `tasksize` expressions.
+    void maketasks(uint64_t tasksize)
+    {
+        tasks.clear();
+        for (int shape = 0 ; shape < shapesizes.size() ; shape++)
+            for (uint64_t first = 0 ; first < shapesizes[shape] ; first += tasksize)
+                tasks.push_back({shape, first, std::min(first+tasksize, shapesizes[shape])});
+    }
+    uint64_t nexpressions() const
+    {
+        uint64_t total = 0;
+        for (auto& task : tasks)
+            total += task.last - task.first;
+        return total;
+    }
+};
+
+// hands out tasks to the workers: each worker starts with its own contiguous
+// range of tasks. When that is exhausted, it steals the upper half of the
+// remaining range of the worker with the most tasks left.
+struct Scheduler {
+    struct Range {
+        std::mutex m;
+        size_t next = 0;
+        size_t end = 0;
+    };
+    std::vector<Range> ranges;
+    bool ordered;              // all workers take the tasks in order from one range
+    std::vector<int> nodes;    // the node of each worker, steals from the same node are preferred
+
+    Scheduler(size_t ntasks, int nworkers, bool ordered = false, std::vector<int> nodes = {})
+        : ranges(ordered ? 1 : nworkers), ordered(ordered), nodes(nodes)
+    {
+        if (this->nodes.empty())
+            this->nodes.resize(nworkers);
+        for (int w = 0 ; w < ranges.size() ; w++) {
+            ranges[w].next = ntasks*w/ranges.size();
+            ranges[w].end = ntasks*(w+1)/ranges.size();
+        }
+    }
+    size_t remaining(int w)
+    {
+        std::lock_guard<std::mutex> lock(ranges[w].m);
+        return ranges[w].end - ranges[w].next;
+    }
+    // get the next task position for worker `w`, returns false when all work is done.
+    bool next(Worker& w, size_t& pos)
+    {
+        if (ordered) {
+            std::lock_guard<std::mutex> lock(ranges[0].m);
+            if (ranges[0].next == ranges[0].end)
+                return false;
+            pos = ranges[0].next++;
+            return true;
+        }
+        auto& own = ranges[w.id];
+        {
+            std::lock_guard<std::mutex> lock(own.m);
+            if (own.next < own.end) {
+                pos = own.next++;
+                return true;
+            }
+        }
+        while (true) {
+            // the victim with the most work left, from the own node when possible
+            int victim = -1;
+            size_t most = 0;
+            bool local = false;
+            for (int v = 0 ; v < ranges.size() ; v++) {
+                size_t left = v==w.id ? 0 : remaining(v);
+                bool samenode = nodes[v] == nodes[w.id];
+                if (left && ((samenode && !local) || ((samenode || !local) && left > most))) {
+                    most = left;
+                    victim = v;
+                    local = samenode;
+                }
+            }
+            if (victim < 0)
+                return false;
+
+            size_t first, last;
+            {
+                std::lock_guard<std::mutex> lock(ranges[victim].m);
+                auto& r = ranges[victim];
+                if (r.next == r.end)
+                    continue;    // someone else was faster, try again
+                first = r.next + (r.end - r.next)/2;
+                last = r.end;
+                r.end = first;
+                if (first == r.next)
+                    r.end = r.next;
+            }
+            w.steals++;
+            if (!local)
+                w.remotesteals++;
+            std::lock_guard<std::mutex> lock(own.m);
+            own.next = first+1;
+            own.end = last;
+            pos = first;
+            return true;
+        }
+    }
+};
+
+// totals of a search run
+struct SearchStats {
+    uint64_t evaluated = 0;
+    uint64_t hits = 0;
+    uint64_t tasks = 0;
+    uint64_t steals = 0;
+    uint64_t remotesteals = 0;    // --numa: steals across nodes
+    uint64_t pipelinewaits = 0;   // --pipeline: nr of batches a worker had to wait for the format stage
+    uint64_t duplicates = 0;      // --dedup: hits not reported
+    std::shared_ptr<DistinctValues> distinct;    // --distinct: the collected hits, ready to be merged
+    std::shared_ptr<DistinctEstimate> estimate;  // --estimate: the merged sketches
+    std::shared_ptr<IntBitmap> reached;          // --coverage: the union of the worker bitmaps
+    double seconds = 0;
+
+    // per worker
+    std::vector<uint64_t> workerevaluated;
+    std::vector<double> workerbusy;       // seconds
+    std::vector<PerfCounters> perf;
+
+    // --profile, the sum of the worker profiles
+    std::vector<ShapeProfile> shapeprof;
+    std::vector<uint64_t> opvalid;
+    std::vector<uint64_t> ophits;
+
+    // cfg.collecthits: all hits, with a copy of their expression
+    std::vector<std::pair<T, Node::ptr>> collected;
+};
+
+#ifndef _WIN32
+extern volatile sig_atomic_t statusrequested;
+
+void requeststatus(int);
+#endif
+
+/*
+Reports on a running search, from its own thread:
+ - every `cfg.progress` seconds a line on stderr with the fraction done, rate, hits and ETA.
+ - the same interval, the metrics file is rewritten, in the prometheus text format.
+ - on SIGUSR1 a full status dump with the counters of each worker on stderr.
+ */
+struct Monitor {
+    const Engine& engine;
+    const std::vector<std::unique_ptr<Worker>>& workers;
+    uint64_t total;
+    timer t;
+
+    std::mutex m;
+    std::condition_variable cv;
+    bool finished = false;
+    std::thread th;
+    const SearchHooks *hooks;
+
+    Monitor(const Engine& engine, const std::vector<std::unique_ptr<Worker>>& workers, uint64_t total, const SearchHooks *hooks);
+    ~Monitor();
+
+    struct Totals {
+        uint64_t evaluated = 0, hits = 0, tasks = 0, steals = 0, done = 0;
+        double seconds = 0;
+        double rate() const { return seconds ? done / seconds : 0; }
+    };
+    Totals totals() const;
+    double eta(const Totals& tot) const
+    {
+        return tot.done ? (total - tot.done) / tot.rate() : 0;
+    }
+
+    std::string progressline() const;
+    // write to a temporary file first, so a scraper never sees a partial file.
+    void writemetrics() const;
+    void dumpstatus() const;
+    void reportprogress() const;
+    void run();
+};
+
+// run the tasks listed in `order` ( default: all tasks ) on `nthreads` worker threads.
+// When `out` is set, results are printed, and a '=====' line with the time
+// spent on each shape is printed when all its tasks are done.
+// With `timelimit` set, the workers stop after that many seconds, this is used for calibration.
+// `hooks` pass the hits and progress to an embedding program, and let it cancel the search.
+SearchStats runsearch(Engine& engine, int nthreads, Output *out, std::vector<size_t> order = {}, double timelimit = 0, const SearchHooks *hooks = nullptr);
+
+// run `fn` on `nthreads` threads, each getting its own thread index
+void parallel(int nthreads, std::function<void(int)> fn);
+
+// run `fn` on a thread pinned to each of `cpus`, getting the index in `cpus`.
+// Memory first touched by fn is then allocated on the node of that cpu.
+void pinnedparallel(const std::vector<int>& cpus, std::function<void(int)> fn);
+
+// the result of evaluating a tree with op assignment `index`
+struct EvalResult {
+    uint64_t index;
+    T value;
+};
+
+// evaluate `expr` with the values from cfg.nums and the op assignments [first, last),
+// skipping the assignments a widening search already did.
+// The values are set once, only the operations change per expression.
+Generator<EvalResult> enumresults(const SearchConfig& cfg, Node::ptr expr, uint64_t first, uint64_t last);
+
+// enum all tree shapes, then for each tree assign all possible combinations of operations
+// and the values from 1 - 9.
+struct EnumEngine : Engine {
+    std::vector<std::vector<Node::ptr>> shapes;   // each worker evaluates its own copy of the trees
+    uint64_t nassign = 0;
+
+    EnumEngine(const SearchConfig& cfg)
+        : Engine(cfg)
+    {
+    }
+    void prepare(int nworkers) override
+    {
+        TraceSpan span("compile shapes");
+        int n = cfg.nums.size();
+        shapes.resize(nworkers);
+        auto build = [&](int w) {
+            for (auto expr : treeshapes(n))
+                shapes[w].push_back(expr);
+        };
+        // --numa: each copy is built by a thread on the node of its worker
+        if (cfg.numa)
+            pinnedparallel(topology().placement(nworkers), build);
+        else
+            for (int w = 0 ; w < nworkers ; w++)
+                build(w);
+        nassign = upow(cfg.binops.size(), n-1);
+        for (int k = 0 ; k < shapes[0].size() ; k++) {
+            std::ostringstream os;
+            os << shapes[0][k];
+            shapenames.push_back(os.str());
+            shapesizes.push_back(nassign);
+        }
+    }
+    void runtask(const Task& task, Worker& w) override
+    {
+        auto expr = shapes[w.id][task.shape];
+        int nops = cfg.nums.size()-1;
+        for (auto& r : enumresults(cfg, expr, task.first, task.last)) {
+            w.evaluated++;
+            bool hit = cfg.ishit(r.value);
+            if (hit)
+                w.report(r.value, expr);
+            if (w.profiling && w.profile(task.shape, r.value, hit)) {
+                uint64_t cur = r.index;
+                for (int p = 0 ; p < nops ; p++) {
+                    w.countop(cur % cfg.binops.size(), hit);
+                    cur /= cfg.binops.size();
+                }
+            }
+        }
+    }
+};
+
+/*
+hybrid engine
+
+For all intervals [i,j) of at most L numbers, the set of distinct values is
+calculated bottom up, dynamic programming style. Above that, the top level
+tree shapes ( 'skeletons' ) with value sets as leaves are enumerated
+together with all operation assignments.
+
+With L=1 this is the same as the plain enumeration, with L=nums.size()
+this is a full DP search, reporting each distinct value once.
+Smaller L needs less memory, larger L less time.
+
+Results which are NaN are dropped from the value sets, and not reported.
+ */
+
+// a distinct value in a value set, with a back reference to how it was made.
+struct SetEntry {
+    T value;
+    int split;      // -1 for a leaf, otherwise the split point of the interval
+    int op;         // index in binops
+    int left;       // index in the value set for [i,split)
+    int right;      // index in the value set for [split,j)
+    bool isnew;     // when widening: this value can not be made with only the old operations
+};
+
+using SetVector = std::vector<SetEntry, CountingAllocator<SetEntry, MEM_VALUESETS>>;
+
+// value sets for all intervals [i,j) of the list of numbers
+struct ValueSets {
+    int n;
+    std::vector<SetVector> sets;
+
+    ValueSets(int n)
+        : n(n), sets(n*(n+1))
+    {
+    }
+    SetVector& at(int i, int j) { return sets[i*(n+1)+j]; }
+    const SetVector& at(int i, int j) const { return sets[i*(n+1)+j]; }
+
+    size_t bytes() const
+    {
+        size_t total = 0;
+        for (auto& s : sets)
+            total += s.capacity()*sizeof(SetEntry);
+        return total;
+    }
+};
+
+// values are deduplicated by their bit pattern, so -0 and 0 stay distinct.
+inline uint64_t valuebits(T v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+// the (estimated) nr of entries of the value set for each interval [i,j),
+// indexed by i*(n+1)+j. Used by the cost model.
+using SetSizes = std::vector<double>;
+
+SetSizes setsizes(const ValueSets& vs);
+
+// the nr of operation evaluations needed to build the value sets of length len
+double levelcost(const SetSizes& size, int n, int nops, int len);
+
+// calculate the distinct values for the interval [i,j) from the sets of its sub intervals.
+void buildset(ValueSets& vs, const SearchConfig& cfg, int i, int j);
+
+// the nr of expressions evaluated at the top level of [i,j), when the value sets
+// up to length L are available.
+double topcost(const SetSizes& size, int n, int nops, int L, int i, int j);
+
+// the cost model: building the value sets of length len+1 is worth it
+// when that is cheaper than the top level enumeration it replaces,
+// and the estimated size of all sets stays within `membudget` bytes.
+// `ratio` is the expected fraction of distinct values per evaluation.
+bool worthbuilding(const SetSizes& size, int n, int nops, int len, double ratio, size_t membudget);
+
+// build the value sets for all intervals up to length L.
+// when L is 0, the cost model decides how far to go.
+// A level is not built when it would exceed the hard memory limit, the
+// remaining levels are then enumerated by the hybrid engine instead.
+int buildsets(ValueSets& vs, const SearchConfig& cfg, int L, size_t membudget, int nthreads);
+
+// a top level tree shape for the hybrid engine, in postfix notation.
+struct Skeleton {
+    std::vector<std::pair<int,int>> leaves; // the intervals of the value set leaves
+    std::vector<int> code;                  // >=0: push a leaf value, -1: apply the next operation
+    int nops = 0;
+};
+
+// generate all skeletons for the interval [i,j), subtrees of at most L numbers become leaves.
+Generator<Skeleton> skeletonshapes(int i, int j, int L);
+
+// render a skeleton, value set leaves are shown as {a b c}.
+std::string describe(const Skeleton& sk, const std::vector<int>& nums);
+
+// reconstruct the expression tree for entry `idx` in the value set of [i,j)
+Node::ptr makenode(const ValueSets& vs, const SearchConfig& cfg, int i, int j, int idx);
+
+// reconstruct the expression tree for a skeleton with the chosen set entries and operations
+Node::ptr makenode(const ValueSets& vs, const SearchConfig& cfg, const Skeleton& sk, const std::vector<int>& choice, const std::vector<int>& ops);
+
+// evaluate a skeleton with the given leaf values and operations
+inline T evalskeleton(const Skeleton& sk, const std::vector<Operation*>& binops, const T *leafvalues, const int *ops)
+{
+    T stack[64];
+    int sp = 0;
+    for (auto c : sk.code) {
+        if (c >= 0) {
+            stack[sp++] = leafvalues[c];
+        }
+        else {
+            sp--;
+            stack[sp-1] = binops[*ops++]->bin(stack[sp-1], stack[sp]);
+        }
+    }
+    return stack[0];
+}
+
+// search with value sets for the intervals up to length L, and enumerate
+// all combinations of value set entries and operations for each skeleton.
+struct HybridEngine : Engine {
+    ValueSets vs;
+    int L = 0;
+    std::vector<Skeleton> skeletons;
+    std::vector<std::unique_ptr<ValueSets>> replicas;  // --numa: a copy of the value sets on each node
+
+    HybridEngine(const SearchConfig& cfg)
+        : Engine(cfg), vs(cfg.nums.size())
+    {
+    }
+    void prepare(int nworkers) override
+    {
+        L = buildsets(vs, cfg, cfg.maxlen, cfg.membudget, nworkers);
+        if (cfg.numa && topology().nnodes > 1) {
+            TraceSpan span("replicate value sets");
+            std::vector<int> nodecpus(topology().nnodes, -1);
+            for (int k = 0 ; k < topology().cpus.size() ; k++)
+                if (nodecpus[topology().cpunode[k]] < 0)
+                    nodecpus[topology().cpunode[k]] = topology().cpus[k];
+            replicas.resize(nodecpus.size());
+            pinnedparallel(nodecpus, [&](int node) { replicas[node] = std::make_unique<ValueSets>(vs); });
+        }
+        TraceSpan span("compile skeletons");
+        for (auto& sk : skeletonshapes(0, cfg.nums.size(), L)) {
+            uint64_t count = upow(cfg.binops.size(), sk.nops);
+            for (auto [i, j] : sk.leaves)
+                count *= vs.at(i, j).size();
+            shapenames.push_back(describe(sk, cfg.nums));
+            shapesizes.push_back(count);
+            skeletons.push_back(sk);
+        }
+    }
+    // count the operations used in a set entry, for the profile
+    void countops(const ValueSets& vs, int i, int j, int idx, Worker& w, bool hit) const
+    {
+        auto& e = vs.at(i,j)[idx];
+        if (e.split < 0)
+            return;
+        w.countop(e.op, hit);
+        countops(vs, i, e.split, e.left, w, hit);
+        countops(vs, e.split, j, e.right, w, hit);
+    }
+
+    std::string info() const override
+    {
+        std::string info = "value sets up to length " + std::to_string(L) + ", " + std::to_string(vs.bytes()) + " bytes";
+        if (!replicas.empty())
+            info += ", replicated on " + std::to_string(replicas.size()) + " nodes";
+        return info;
+    }
+
+    // enumerate the combinations [first, last) of a skeleton: the op assignment
+    // is the low 'digit' of the combination index, followed by the set entry for each leaf.
+    void runtask(const Task& task, Worker& w) override
+    {
+        auto& sk = skeletons[task.shape];
+        const ValueSets& vs = replicas.empty() ? this->vs : *replicas[w.node];
+        int nleaves = sk.leaves.size();
+        std::vector<const SetVector*> sets;
+        for (auto [i, j] : sk.leaves)
+            sets.push_back(&vs.at(i, j));
+
+        int nops = cfg.binops.size();
+        uint64_t nassign = upow(nops, sk.nops);
+        std::vector<int> choice(nleaves);
+        std::vector<T> leafvalues(nleaves);
+        std::vector<int> ops(sk.nops);
+
+        uint64_t combo = task.first / nassign;
+        for (int l = 0 ; l < nleaves ; l++) {
+            choice[l] = combo % sets[l]->size();
+            combo /= sets[l]->size();
+        }
+        uint64_t i = task.first % nassign;
+        uint64_t idx = task.first;
+        while (idx < task.last) {
+            bool leavesnew = false;
+            for (int l = 0 ; l < nleaves ; l++) {
+                auto& e = (*sets[l])[choice[l]];
+                leafvalues[l] = e.value;
+                leavesnew |= e.isnew;
+            }
+            for ( ; i < nassign && idx < task.last ; i++, idx++) {
+                if (cfg.widening && !leavesnew && !usesnewop(cfg.isold, sk.nops, i)) {
+                    uint64_t next = nextnewassignment(cfg.isold, sk.nops, i);
+                    idx += next - i - 1;
+                    i = next - 1;
+                    continue;
+                }
+                uint64_t cur = i;
+                for (int p = 0 ; p < sk.nops ; p++) {
+                    ops[p] = cur % nops;
+                    cur /= nops;
+                }
+                T result = evalskeleton(sk, cfg.binops, leafvalues.data(), ops.data());
+                w.evaluated++;
+                bool hit = !std::isnan(result) && cfg.ishit(result);
+                if (hit)
+                    w.report(result, makenode(vs, cfg, sk, choice, ops));
+                if (w.profiling && w.profile(task.shape, result, hit)) {
+                    for (auto op : ops)
+                        w.countop(op, hit);
+                    for (int l = 0 ; l < nleaves ; l++)
+                        countops(vs, sk.leaves[l].first, sk.leaves[l].second, choice[l], w, hit);
+                }
+            }
+            i = 0;
+
+            // next combination of value set entries
+            for (int l = 0 ; l < nleaves && ++choice[l] == sets[l]->size() ; l++)
+                choice[l] = 0;
+        }
+    }
+};
+
+/*
+lanes engine
+
+Searches several number sequences of the same length at once, like all permutations of
+a set of numbers. Each ( shape, op assignment ) is evaluated for `LANES` sequences together:
+the leaf values are stored per leaf for all lanes, and every lane applies the same operation,
+so each step of the postfix program is a branch free loop over the lanes, which the compiler
+turns into SIMD instructions for + - * /.
+ */
+constexpr int LANES = 8;
+
+// an operation applied to all lanes: a[l] = a[l] op b[l]
+using LaneKernel = void (*)(T *a, const T *b, T (*bin)(T, T));
+
+template<typename OP>
+void lanekernel(T *a, const T *b, T (*)(T, T))
+{
+    OP op;
+    for (int l = 0 ; l < LANES ; l++)
+        a[l] = op(a[l], b[l]);
+}
+// pow and cat: a function call per lane
+inline void lanecall(T *a, const T *b, T (*bin)(T, T))
+{
+    for (int l = 0 ; l < LANES ; l++)
+        a[l] = bin(a[l], b[l]);
+}
+LaneKernel findlanekernel(const Operation *op);
+
+// evaluate a skeleton for LANES sequences, `leafvalues` has LANES values for each leaf
+void evallanes(const Skeleton& sk, const std::vector<Operation*>& binops, const std::vector<LaneKernel>& kernels,
+        const T *leafvalues, const int *ops, T *result);
+
+struct LanesEngine : Engine {
+    std::vector<Skeleton> skeletons;
+    std::vector<LaneKernel> kernels;       // per binop
+    int ngroups = 0;                       // groups of LANES sequences, the last one padded
+    std::vector<T> leafvalues;             // per group, per leaf, per lane
+
+    LanesEngine(const SearchConfig& cfg)
+        : Engine(cfg)
+    {
+    }
+    void prepare(int) override
+    {
+        int n = cfg.nums.size();
+        for (auto op : cfg.binops)
+            kernels.push_back(findlanekernel(op));
+        ngroups = (cfg.sequences.size() + LANES-1) / LANES;
+        leafvalues.resize(ngroups * n * LANES);
+        for (int s = 0 ; s < ngroups*LANES ; s++) {
+            auto& seq = cfg.sequences[std::min(s, int(cfg.sequences.size())-1)];
+            for (int k = 0 ; k < n ; k++)
+                leafvalues[((s/LANES)*n + k)*LANES + s%LANES] = seq[k];
+        }
+        // the task index is op assignment * ngroups + group, so all groups of one assignment are adjacent
+        uint64_t nassign = upow(cfg.binops.size(), n-1);
+        for (auto& sk : skeletonshapes(0, n, 1)) {
+            shapenames.push_back(describe(sk, std::vector<int>(n, 0)));
+            shapesizes.push_back(nassign * ngroups);
+            skeletons.push_back(sk);
+        }
+    }
+    std::string info() const override
+    {
+        return std::to_string(cfg.sequences.size()) + " sequences, in " + std::to_string(ngroups) + " groups of " + std::to_string(LANES) + " lanes";
+    }
+    Node::ptr makeexpr(const Skeleton& sk, const std::vector<int>& seq, const std::vector<int>& ops) const
+    {
+        std::vector<Node::ptr> stack;
+        int iop = 0;
+        for (auto c : sk.code) {
+            if (c >= 0) {
+                auto v = Value::make();
+                v->value = seq[sk.leaves[c].first];
+                stack.push_back(v);
+            }
+            else {
+                auto r = stack.back(); stack.pop_back();
+                auto l = stack.back(); stack.pop_back();
+                auto x = Expr::make(l, r);
+                x->op = cfg.binops[ops[iop++]];
+                stack.push_back(x);
+            }
+        }
+        return stack.back();
+    }
+    void runtask(const Task& task, Worker& w) override
+    {
+        auto& sk = skeletons[task.shape];
+        int n = cfg.nums.size();
+        int nops = cfg.binops.size();
+        std::vector<int> ops(sk.nops);
+        alignas(64) T results[LANES];
+        uint64_t decoded = ~uint64_t(0);
+        for (uint64_t idx = task.first ; idx < task.last ; idx++) {
+            uint64_t i = idx / ngroups;
+            int g = idx % ngroups;
+            if (i != decoded) {
+                if (cfg.widening && !usesnewop(cfg.isold, sk.nops, i)) {
+                    // continue with the first group of the next assignment with a new op
+                    idx = nextnewassignment(cfg.isold, sk.nops, i) * ngroups - 1;
+                    continue;
+                }
+                decoded = i;
+                uint64_t cur = i;
+                for (int p = 0 ; p < sk.nops ; p++) {
+                    ops[p] = cur % nops;
+                    cur /= nops;
+                }
+            }
+            evallanes(sk, cfg.binops, kernels, &leafvalues[g*n*LANES], ops.data(), results);
+            int nlanes = std::min(LANES, int(cfg.sequences.size()) - g*LANES);
+            for (int l = 0 ; l < nlanes ; l++) {
+                w.evaluated++;
+                bool hit = cfg.ishit(results[l]);
+                if (hit)
+                    w.report(results[l], makeexpr(sk, cfg.sequences[g*LANES + l], ops));
+                if (w.profiling && w.profile(task.shape, results[l], hit))
+                    for (auto op : ops)
+                        w.countop(op, hit);
+            }
+        }
+    }
+};
+
+// print the memory use per subsystem on stderr
+void printmemory();
+
+// print the --profile report on stderr. The time per shape is the sum of the time spent by all workers.
+void printprofile(const Engine& engine, const SearchStats& stats);
+
+// print the --perf-counters report on stderr, per worker and the total
+void printperf(const Engine& engine, const SearchStats& stats);
+
+std::unique_ptr<Engine> makeengine(const SearchConfig& cfg);
+
+// --estimate: the distinct values overall, and per range, with the memory a dp value set
+// of that size would take
+void printestimate(const DistinctEstimate& est, const SearchStats& stats);
+
+// --coverage: how many of the integers [0, n) are reached, and which are not
+void printcoverage(IntBitmap reached, uint64_t n);
+
+// run the search configured in `cfg`, printing all results
+void search(const SearchConfig& cfg);
+
+// count the nr of binary tree shapes with n leaves: the catalan number C(n-1)
+uint64_t countshapes(int n);
+
+/*
+Print the exact size of the search space, the memory needed by the value sets,
+and a runtime estimate, without doing the actual search.
+
+The runtime is estimated by timing the evaluation of `nsamples` randomly chosen
+expressions with the selected engine. The time needed for printing results is not included.
+ */
+void plansearch(const SearchConfig& cfg, int nsamples);
+
+// re-evaluate an expression in long double, to tell rounding differences from real errors
+long double exacteval(const Node::ptr& t);
+
+// the distinct hit values of a search, by bit pattern, with an expression for each.
+// NaN results are left out, the enum engine reports them, the value set engines do not.
+std::map<uint64_t, Node::ptr> hitset(SearchConfig cfg, const std::string& engine, int L);
+
+// compare the hits of `name` with the reference hits, returns the nr of real mismatches.
+// A value missing on one side counts as rounding when the other side has a value which is
+// within 1e-9 of it, and the long double evaluation of its expression agrees with both.
+int comparehits(const std::string& name, const std::map<uint64_t, Node::ptr>& ref, const std::map<uint64_t, Node::ptr>& hits, const std::string& trial);
+
+// run the engines side by side on random small searches, and compare their hits with
+// the enum engine, which evaluates each expression tree and is the reference.
+// returns the nr of mismatches.
+int crosscheck(const SearchConfig& base, int ntrials, uint64_t seed);
+
+// identifies the workload in the tune file
+std::string tunekey(const SearchConfig& cfg);
+
+// the tune file has one line per workload: the key, followed by key=value settings.
+std::string tunesettings(const SearchConfig& cfg);
+
+void savetuning(const std::string& tunefile, const SearchConfig& cfg);
+
+// apply the tuned settings for this workload, returns false when there are none.
+bool loadtuning(const std::string& tunefile, SearchConfig& cfg);
+
+/*
+Find the fastest engine configuration for this workload on this machine.
+
+Each candidate: the enum engine, the hybrid engine with value sets of length 2 .. n-1,
+and the dp engine, with a range of task sizes, is prepared and then run for
+`tunetime` seconds on a random selection of its tasks. The runtime is estimated from
+the preparation time and the measured rate. Set lengths are tried as long as building
+them stays within about 10 times the calibration time and within the memory budget.
+With several number sequences only the lanes engine, `-e enum`, is tried.
+
+The best configuration is saved in the tune file, use `-e auto` to use it.
+ */
+void autotune(SearchConfig cfg, const std::string& tunefile, double tunetime);
+
+}   // namespace findexpr
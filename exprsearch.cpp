@@ -0,0 +1,198 @@
+/*
+
+exprsearch: library interface to the findexpr expression search, see exprsearch.h
+
+Author: Willem Hengeveld <itsme@xs4all.nl>
+*/
+#include <deque>
+#include <stdexcept>
+#include "exprcore.h"
+#include "exprsearch.h"
+
+namespace findexpr {
+
+struct ExprSearch::Impl {
+    SearchConfig cfg;
+    SearchHooks hooks;
+    std::atomic<bool> cancelflag = false;
+    bool started = false;
+
+    std::function<void(const SearchProgress&)> progressfn;
+    mutable std::mutex progressmutex;
+    SearchProgress last;
+
+    // the pull interface: results queued by the workers, and the thread running the search
+    std::mutex m;
+    std::condition_variable notempty;
+    std::condition_variable notfull;
+    std::deque<SearchResult> queue;
+    size_t queuesize;
+    bool finished = false;
+    std::thread th;
+
+    void search(std::function<void(T, const Node::ptr&)> onhit)
+    {
+        hooks.onhit = onhit;
+        hooks.cancel = &cancelflag;
+        if (progressfn)
+            hooks.onprogress = [this](uint64_t done, uint64_t total, uint64_t evaluated, uint64_t hits, double seconds) {
+                SearchProgress p;
+                p.done = done;
+                p.total = total;
+                p.evaluated = evaluated;
+                p.hits = hits;
+                p.seconds = seconds;
+                {
+                    std::lock_guard<std::mutex> lock(progressmutex);
+                    last = p;
+                }
+                progressfn(p);
+            };
+
+        auto engine = makeengine(cfg);
+        engine->prepare(cfg.nthreads);
+        engine->maketasks(cfg.tasksize);
+        if (!cancelflag)
+            runsearch(*engine, cfg.nthreads, nullptr, {}, 0, &hooks);
+    }
+
+    void cancel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            cancelflag = true;
+        }
+        notempty.notify_all();
+        notfull.notify_all();
+    }
+};
+
+ExprSearch::ExprSearch(const SearchOptions& opts)
+    : impl(std::make_unique<Impl>())
+{
+    auto& cfg = impl->cfg;
+    if (opts.numbers.empty())
+        throw std::invalid_argument("no numbers");
+    cfg.nums = opts.numbers;
+    cfg.targets = opts.targets;
+    cfg.dedup = opts.dedup;
+
+    if (opts.operations.empty()) {
+        for (auto& op : oplist)
+            if (op.n == 2)
+                cfg.binops.push_back(&op);
+    }
+    for (auto& name : opts.operations) {
+        auto op = findbinop(name);
+        if (!op)
+            throw std::invalid_argument("unknown operation: " + name);
+        cfg.binops.push_back(op);
+    }
+    std::vector<Operation*> oldops;
+    for (auto& name : opts.widenfrom) {
+        auto op = findbinop(name);
+        if (!op)
+            throw std::invalid_argument("unknown operation: " + name);
+        oldops.push_back(op);
+    }
+    cfg.widening = !oldops.empty();
+    cfg.isold.resize(cfg.binops.size());
+    for (int j = 0 ; j < cfg.binops.size() ; j++)
+        cfg.isold[j] = std::find(oldops.begin(), oldops.end(), cfg.binops[j]) != oldops.end();
+
+    if (opts.engine != "enum" && opts.engine != "hybrid" && opts.engine != "dp")
+        throw std::invalid_argument("unknown engine: " + opts.engine);
+    cfg.engine = opts.engine;
+    cfg.maxlen = opts.engine == "dp" ? cfg.nums.size() : opts.maxlen;
+    cfg.maxmemory = opts.maxmemory;
+    cfg.nthreads = opts.threads ? opts.threads : topology().defaultthreads();
+    cfg.tasksize = opts.tasksize;
+    if (cfg.nthreads < 1 || cfg.tasksize < 1)
+        throw std::invalid_argument("invalid thread count or task size");
+    impl->queuesize = std::max(size_t(1), opts.queuesize);
+}
+
+ExprSearch::~ExprSearch()
+{
+    impl->cancel();
+    if (impl->th.joinable())
+        impl->th.join();
+}
+
+void ExprSearch::onprogress(std::function<void(const SearchProgress&)> fn, double interval)
+{
+    impl->progressfn = fn;
+    impl->hooks.progressinterval = interval;
+}
+
+void ExprSearch::run(std::function<bool(const SearchResult&)> fn)
+{
+    if (impl->started)
+        throw std::logic_error("ExprSearch can only run once");
+    impl->started = true;
+    std::mutex m;
+    impl->search([&](T value, const Node::ptr& expr) {
+            if (impl->cancelflag)
+                return;
+            std::ostringstream os;
+            os << expr;
+            std::lock_guard<std::mutex> lock(m);
+            if (!impl->cancelflag && !fn(SearchResult{ value, os.str() }))
+                impl->cancelflag = true;
+            });
+}
+
+void ExprSearch::start()
+{
+    if (impl->started)
+        return;
+    impl->started = true;
+    impl->th = std::thread([this]() {
+            impl->search([this](T value, const Node::ptr& expr) {
+                    std::ostringstream os;
+                    os << expr;
+                    std::unique_lock<std::mutex> lock(impl->m);
+                    impl->notfull.wait(lock, [this]() { return impl->cancelflag || impl->queue.size() < impl->queuesize; });
+                    if (impl->cancelflag)
+                        return;
+                    impl->queue.push_back(SearchResult{ value, os.str() });
+                    impl->notempty.notify_one();
+                    });
+            {
+                std::lock_guard<std::mutex> lock(impl->m);
+                impl->finished = true;
+            }
+            impl->notempty.notify_all();
+            });
+}
+
+std::optional<SearchResult> ExprSearch::next()
+{
+    start();
+    std::unique_lock<std::mutex> lock(impl->m);
+    impl->notempty.wait(lock, [this]() { return impl->cancelflag || impl->finished || !impl->queue.empty(); });
+    if (impl->cancelflag || impl->queue.empty())
+        return std::nullopt;
+    auto r = std::move(impl->queue.front());
+    impl->queue.pop_front();
+    impl->notfull.notify_one();
+    return r;
+}
+
+void ExprSearch::cancel()
+{
+    impl->cancel();
+}
+
+bool ExprSearch::cancelled() const
+{
+    return impl->cancelflag;
+}
+
+SearchProgress ExprSearch::progress() const
+{
+    std::lock_guard<std::mutex> lock(impl->progressmutex);
+    return impl->last;
+}
+
+}   // namespace findexpr
@@ -0,0 +1,116 @@
+/*
+
+exprsearch: library interface to the findexpr expression search.
+
+Configure the numbers, operations, engine, targets and threads with SearchOptions,
+then consume the results either with a callback:
+
+    ExprSearch search(opts);
+    search.run([](const SearchResult& r) { std::cout << r.value << "=" << r.expression << "\n"; return true; });
+
+or by pulling them, the search runs in the background, ahead of the consumer:
+
+    for (auto& r : search)
+        ...
+
+The search can be cancelled from any thread with cancel(), or by returning false
+from the callback.
+
+Author: Willem Hengeveld <itsme@xs4all.nl>
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <cstdint>
+
+namespace findexpr {
+
+struct SearchOptions {
+    std::vector<int> numbers = { 1,2,3,4,5,6,7,8,9 };
+    std::vector<std::string> operations;   // names or infix symbols: add or +, ..., empty: all binary operations
+    std::vector<std::string> widenfrom;    // operations already searched in a previous run, like -w
+    std::string engine = "enum";           // enum, hybrid or dp
+    int maxlen = 0;                        // hybrid: max interval length of the value sets, 0: cost model
+    size_t maxmemory = 0;                  // hard memory limit in bytes, 0: none
+    std::vector<int> targets;              // report only values near one of these, empty: all values
+    bool dedup = false;                    // skip expressions differing only by order or grouping of sums and products
+    int threads = 0;                       // 0: nr of cpus
+    uint64_t tasksize = 1<<16;             // nr of expressions per task
+    size_t queuesize = 4096;               // pull interface: nr of results buffered ahead of the consumer
+};
+
+struct SearchResult {
+    double value;
+    std::string expression;
+};
+
+struct SearchProgress {
+    uint64_t done = 0;         // nr of expressions in completed tasks
+    uint64_t total = 0;        // nr of expressions in all tasks
+    uint64_t evaluated = 0;
+    uint64_t hits = 0;
+    double seconds = 0;
+};
+
+class ExprSearch {
+public:
+    // throws std::invalid_argument for unknown operations or engines
+    explicit ExprSearch(const SearchOptions& opts);
+    // cancels a running search, and waits for it
+    ~ExprSearch();
+
+    // `fn` is called every `interval` seconds, and at the end, from a monitor thread.
+    void onprogress(std::function<void(const SearchProgress&)> fn, double interval = 1);
+
+    // run the search, `fn` is called for each result, from the worker threads, but never concurrently.
+    // Returning false cancels the search. Returns when the search is finished or cancelled.
+    void run(std::function<bool(const SearchResult&)> fn);
+
+    // start the search in the background, for the pull interface
+    void start();
+    // the next result, waits until one is available. nullopt when the search is finished or cancelled.
+    // Starts the search when needed.
+    std::optional<SearchResult> next();
+
+    // stop the search, can be called from any thread
+    void cancel();
+    bool cancelled() const;
+
+    // the last reported progress
+    SearchProgress progress() const;
+
+    // input iterator over the results, for range based for loops, begin() starts the search.
+    class iterator {
+        ExprSearch *search;
+        std::optional<SearchResult> cur;
+    public:
+        iterator(ExprSearch *search)
+            : search(search)
+        {
+            if (search)
+                ++*this;
+        }
+        const SearchResult& operator*() const { return *cur; }
+        const SearchResult *operator->() const { return &*cur; }
+        iterator& operator++()
+        {
+            cur = search->next();
+            if (!cur)
+                search = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator& rhs) const { return search == rhs.search; }
+        bool operator!=(const iterator& rhs) const { return search != rhs.search; }
+    };
+    iterator begin() { start(); return iterator(this); }
+    iterator end() { return iterator(nullptr); }
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+}   // namespace findexpr
@@ -7,434 +7,682 @@ Like the '10958' problem from Numberphile: https://www.youtube.com/watch?v=-ruC5
 Author: Willem Hengeveld <itsme@xs4all.nl>
 */
 
-#include <stdio.h>
 #include <iostream>
 #include <string>
 #include <vector>
-#include <memory>
-#include <functional>
-#include <cmath>
-#include <optional>
-#include <cpputils/argparse.h>
-#include <cpputils/string-split.h>
+#include <thread>
+#include <map>
+#include <set>
+#include <sstream>
+#include <mutex>
 #ifndef _WIN32
-#include <sys/time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
 #endif
-#include <ctime>
+#include <cpputils/argparse.h>
+#include <cpputils/string-split.h>
+#include "exprcore.h"
+
+using namespace findexpr;
+
 /*
-clang++ -O3 -I ~/myprj/cpputils findexpr.cpp -std=c++1z
+clang++ -O3 -I ~/myprj/cpputils findexpr.cpp -std=c++20
 
 todo:
    support unary operators, like negation
 */
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
 
-// MSVC defines this in winsock2.h!?
-typedef struct timeval {
-    long tv_sec;
-    long tv_usec;
-} timeval;
+#ifndef _WIN32
+/*
+Distributed search: a coordinator hands out leases on ranges of the task list,
+the ranked ( shape, operations ) space, to worker processes over tcp.
+A lease which is not renewed in time is handed out again, so a worker which dies
+only delays the search. The hits of a range are kept by the coordinator until the
+range is completed, and then written to its stdout, so each hit is logged once.
+
+All workers must run the same workload, they build their own task list, the
+coordinator only checks that their workload keys match.
+
+The protocol has one line per message:
+    worker: HELLO <key> <ntasks>      coordinator: OK <lease seconds> | ERROR <reason>
+    worker: LEASE                     coordinator: RANGE <id> <first> <last> | WAIT <seconds> | DONE
+    worker: HIT <id> <value>=<expr>
+    worker: RENEW <id>
+    worker: COMPLETE <id>             coordinator: OK | EXPIRED
+*/
 
-int gettimeofday(struct timeval * tp, struct timezone * tzp)
-{
-    // Note: some broken versions only have 8 trailing zero's, the correct epoch has 9 trailing zero's
-    // This magic number is the number of 100 nanosecond intervals since January 1, 1601 (UTC)
-    // until 00:00:00 January 1, 1970 
-    static const uint64_t EPOCH = ((uint64_t) 116444736000000000ULL);
-
-    SYSTEMTIME  system_time;
-    FILETIME    file_time;
-    uint64_t    time;
-
-    GetSystemTime( &system_time );
-    SystemTimeToFileTime( &system_time, &file_time );
-    time =  ((uint64_t)file_time.dwLowDateTime )      ;
-    time += ((uint64_t)file_time.dwHighDateTime) << 32;
-
-    tp->tv_sec  = (long) ((time - EPOCH) / 10000000L);
-    tp->tv_usec = (long) (system_time.wMilliseconds * 1000);
-    return 0;
-}
-#endif
+// a line based connection
+struct LineSocket {
+    int fd = -1;
+    std::string in;
+    std::mutex sendmutex;
 
-// class for taking usec resolution time measurements.
-struct timer {
-    struct timeval t0;
-    timer()
+    explicit LineSocket(int fd)
+        : fd(fd)
     {
-        gettimeofday(&t0, NULL);
     }
-    uint64_t lap()
+    ~LineSocket()
     {
-        struct timeval t1;
-        gettimeofday(&t1, NULL);
-
-        uint64_t d = tdiff(t1, t0);
-        t0 = t1;
-        return d;
+        if (fd >= 0)
+            close(fd);
     }
-    static uint64_t tdiff(struct timeval &lhs, struct timeval &rhs)
+    bool send(const std::string& line)
     {
-        return uint64_t(lhs.tv_sec-rhs.tv_sec)*1000000ULL + uint64_t(lhs.tv_usec-rhs.tv_usec);
-    }
-};
-
-// the base type we do our calculations in.
-using T = double;
-
-// integer exponentiation
-int intpow(int a, int b)
-{
-    int r = 1;
-    while (b > 0) {
-        if (b&1)
-            r *= a;
-        a *= a;
-        b >>= 1;
-    }
-    return r;
-}
-
-
-// return 10^(trunc(log10(x))+1)
-//
-// calculates the smallest power of ten greater than x
-double tenfactor(double x)
-{
-    double f = 1;
-    int i=0;
-    while (i<20 && x>=f) {
-        f *= 10;
-        i++;
+        std::lock_guard<std::mutex> lock(sendmutex);
+        size_t done = 0;
+        while (done < line.size()) {
+            ssize_t n = ::send(fd, line.data() + done, line.size() - done, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            done += n;
+        }
+        return true;
     }
-    return f;
-}
-
-
-// represent an operation
-struct Operation {
-
-    // name  - the name of the operation
-    // infix - when available: a symbols for infix operator notation ( a+b, instead of add(a,b) )
-    // n     - the nr of arguments to the operation
-    // prec  - the operator precedence
-    // fn    - a lambda calculating this operation.
-    Operation( std::string name, std::string infix, int n, int prec, std::function<T(std::vector<T> args)> fn)
-        : name(name), infix(infix), n(n), precedence(prec), fn(fn)
+    // a complete line from the input buffer, without the newline
+    bool getline(std::string& line)
     {
+        auto nl = in.find('\n');
+        if (nl == std::string::npos)
+            return false;
+        line = in.substr(0, nl);
+        in.erase(0, nl+1);
+        return true;
     }
-
-    std::string name;
-    std::string infix;
-    int n;
-    int precedence;
-    std::function<T(std::vector<T> args)> fn;
-};
-
-// list of supported operations
-std::vector<Operation> oplist{
-    { "add", "+",   2, 1, [](std::vector<T> args){ return args[0]+args[1]; } },
-    { "sub", "-",   2, 1, [](std::vector<T> args){ return args[0]-args[1]; } },
-    { "mul", "*",   2, 2, [](std::vector<T> args){ return args[0]*args[1]; } },
-    { "div", "/",   2, 3, [](std::vector<T> args){ return args[0]/args[1]; } },
-    { "pow", "^",   2, 4, [](std::vector<T> args){ return pow(args[0],args[1]); } },
-    { "cat", "||",  2, 5, [](std::vector<T> args){ return args[0]*tenfactor(args[1])+args[1]; } },
-
-    // NOTE: unary ops not yet supported.
-    { "neg", "-",   1, 2, [](std::vector<T> args){ return -args[0]; } },
-    { "sqrt", "√",  1, 2, [](std::vector<T> args){ return sqrt(args[0]); } },
-};
-int precedence(Operation*op)
-{
-    if (op==nullptr) // values have null.
-        return 9;
-    return op->precedence;
-}
-
-// expression tree base class
-struct Node {
-    using ptr = std::shared_ptr<Node>;
-    virtual Operation *operation() const = 0;
-    virtual T eval() const = 0;
-    virtual void output(std::ostream& os) const = 0;
-
-    friend std::ostream& operator<<(std::ostream& os, Node::ptr t)
+    // read what is available, returns false on eof or error
+    bool receive()
     {
-        t->output(os);
-        return os;
+        char buf[65536];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return false;
+        in.append(buf, n);
+        return true;
     }
-    friend std::ostream& operator<<(std::ostream& os, const Node &t)
+    // wait for a complete line
+    bool readline(std::string& line)
     {
-        t.output(os);
-        return os;
+        while (!getline(line))
+            if (!receive())
+                return false;
+        return true;
     }
-
 };
 
-// represent a value node
-struct Value : Node {
-    T value;
-    virtual Operation *operation() const { return nullptr; }
-    virtual T eval() const { return value; }
-    virtual void output(std::ostream& os) const { os << value; }
+// split "host:port", the host defaults to localhost
+bool parseaddress(const std::string& address, std::string& host, std::string& port)
+{
+    auto colon = address.rfind(':');
+    host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    port = colon == std::string::npos ? address : address.substr(colon+1);
+    if (host.empty())
+        host = "127.0.0.1";
+    return !port.empty();
+}
 
-    static auto make()
-    {
-        return std::make_shared<Value>();
+// identifies the workload: all workers must have the same task list. Only the settings
+// that decide the tasks and hits, not engine.info(), which varies with --numa and memory.
+std::string workloadkey(const SearchConfig& cfg)
+{
+    std::string key = tunekey(cfg) + " targets=";
+    for (auto t : cfg.targets)
+        key += std::to_string(t) + ",";
+    // -v repeated or --permute: all sequences, in the order the lanes engine numbers them
+    key += " sequences=";
+    for (auto& seq : cfg.sequences) {
+        for (auto v : seq)
+            key += std::to_string(v) + ",";
+        key += ";";
     }
-};
+    key += " engine=" + cfg.engine + " L=" + std::to_string(cfg.maxlen) + " tasksize=" + std::to_string(cfg.tasksize) + " ";
+    for (int j = 0 ; j < cfg.isold.size() ; j++)
+        key += cfg.isold[j] ? "o" : "n";
+    // hashed, to get a key without spaces
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hashstring(key));
+    return buf;
+}
 
-// represent an expression node.
-struct Expr : Node {
-    Operation *op;
-    std::vector<Node::ptr> args;
-    Expr(Node::ptr l)
-        : op(nullptr), args{l}
-    {
+// run the coordinator on `address`, until all ranges are done
+int coordinator(const std::string& address, double leasetime, size_t leasesize)
+{
+    std::string host, port;
+    if (!parseaddress(address, host, port)) {
+        std::cerr << "invalid address: " << address << "\n";
+        return 1;
     }
-    Expr(Node::ptr l, Node::ptr r)
-        : op(nullptr), args{l, r}
-    {
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &ai) != 0) {
+        std::cerr << "cannot resolve " << address << "\n";
+        return 1;
     }
-    virtual Operation *operation() const { return op; }
-    virtual T eval() const
-    {
-        std::vector<T> results;
-        for (auto v : args)
-            results.push_back(v->eval());
-        return op->fn(results);
+    int lfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lfd < 0 || bind(lfd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(lfd, 64) < 0) {
+        perror("listen");
+        freeaddrinfo(ai);
+        return 1;
     }
-    virtual void output(std::ostream& os) const
-    {
-        if (!op) {
-            // no operation specified: use placeholder 'op' / '#'
-            if (args.size()==2) {
-                // binary operator
-                os << "(" << args[0] << '#' << args[1] << ")";
+    freeaddrinfo(ai);
+    std::cerr << "coordinator listening on " << host << ":" << port << "\n";
+
+    // the task list is split in chunks of `leasesize` tasks, once the first worker tells its size.
+    enum { FREE, LEASED, DONE };
+    struct Chunk {
+        size_t first, last;
+        int state = FREE;
+        uint64_t lease = 0;
+        double expires = 0;
+        std::string hits;      // kept until the chunk is completed
+    };
+    std::vector<Chunk> chunks;
+    std::map<uint64_t, size_t> leases;     // lease id -> chunk
+    std::map<int, std::set<uint64_t>> leasesof;   // client fd -> lease ids
+    std::string key;
+    uint64_t nextlease = 1;
+    size_t ndone = 0, reassigned = 0;
+    uint64_t nhits = 0;
+    bool started = false;
+
+    std::map<int, std::unique_ptr<LineSocket>> clients;
+    timer clock, tick;
+    auto now = [&]() { return clock.elapsed() / 1e6; };
+
+    // make the chunk of a lease available again
+    auto release = [&](uint64_t id) {
+        auto i = leases.find(id);
+        if (i == leases.end())
+            return;
+        auto& c = chunks[i->second];
+        if (c.state == LEASED && c.lease == id) {
+            c.state = FREE;
+            c.hits.clear();
+            reassigned++;
+        }
+        leases.erase(i);
+    };
+    auto handle = [&](int fd, LineSocket& sock, const std::string& line) -> bool {
+        std::istringstream is(line);
+        std::string cmd;
+        is >> cmd;
+        if (cmd == "HELLO") {
+            std::string wkey;
+            size_t ntasks = 0;
+            is >> wkey >> ntasks;
+            if (!started) {
+                key = wkey;
+                for (size_t first = 0 ; first < ntasks ; first += leasesize)
+                    chunks.push_back(Chunk{ first, std::min(ntasks, first + leasesize), FREE, 0, 0, std::string() });
+                started = true;
             }
-            else if (args.size()==1) {
-                // unary operator
-                os << "f" << "(" << args[0] << ")";
+            else if (wkey != key || ntasks != (chunks.empty() ? 0 : chunks.back().last)) {
+                sock.send("ERROR workload differs from the first worker\n");
+                return false;
             }
-            else {
-                // more args: represent as function call.
-                os << "op(";
-                bool first = true;
-                for (auto arg : args)
-                {
-                    if (!first) os << ",";
-                    os << arg;
-                    first = false;
-                }
-                os << ")";
+            sock.send("OK " + std::to_string(leasetime) + "\n");
+        }
+        else if (cmd == "LEASE") {
+            if (ndone == chunks.size())
+                return sock.send("DONE\n");
+            for (size_t k = 0 ; k < chunks.size() ; k++) {
+                auto& c = chunks[k];
+                if (c.state != FREE)
+                    continue;
+                c.state = LEASED;
+                c.lease = nextlease++;
+                c.expires = now() + leasetime;
+                leases[c.lease] = k;
+                leasesof[fd].insert(c.lease);
+                return sock.send("RANGE " + std::to_string(c.lease) + " " + std::to_string(c.first) + " " + std::to_string(c.last) + "\n");
             }
+            return sock.send("WAIT 1\n");
         }
-        else if (args.size()==2 && !op->infix.empty()) {
-            // todo: num||num  -> num num
-            // todo: num||(num||num)  -> num num num
-            // todo: (num||num)||num  -> num num num
-            //
-            // (a+b) * c
-            bool needbrackets0 = precedence(op) > precedence(args[0]->operation());
-            if (needbrackets0) os << '(';
-            os << args[0];
-            if (needbrackets0) os << ')';
-
-            os << op->infix;
-
-            bool needbrackets1 = precedence(op) > precedence(args[1]->operation());
-            if (needbrackets1) os << '(';
-            os << args[1];
-            if (needbrackets1) os << ')';
+        else if (cmd == "HIT" || cmd == "RENEW" || cmd == "COMPLETE") {
+            uint64_t id = 0;
+            is >> id;
+            auto i = leases.find(id);
+            bool valid = i != leases.end() && chunks[i->second].state == LEASED && chunks[i->second].lease == id;
+            if (cmd == "COMPLETE") {
+                if (!valid)
+                    return sock.send("EXPIRED\n");
+                auto& c = chunks[i->second];
+                std::cout << c.hits << std::flush;
+                nhits += std::count(c.hits.begin(), c.hits.end(), '\n');
+                c.hits.clear();
+                c.state = DONE;
+                ndone++;
+                leases.erase(i);
+                leasesof[fd].erase(id);
+                return sock.send("OK\n");
+            }
+            if (!valid)
+                return true;
+            auto& c = chunks[i->second];
+            c.expires = now() + leasetime;
+            if (cmd == "HIT") {
+                c.hits += line.substr(line.find(' ', 4) + 1);
+                c.hits += '\n';
+            }
         }
-        else if (args.size()==1 && !op->infix.empty()) {
-            // render a unary operator
-            bool needbrackets0 = precedence(op) > precedence(args[0]->operation());
-            os << op->infix;
-            if (needbrackets0) os << '(';
-            os << args[0];
-            if (needbrackets0) os << ')';
+        return true;
+    };
+
+    while (!started || ndone < chunks.size()) {
+        std::vector<pollfd> fds;
+        fds.push_back(pollfd{ lfd, POLLIN, 0 });
+        for (auto& [fd, sock] : clients)
+            fds.push_back(pollfd{ fd, POLLIN, 0 });
+        poll(fds.data(), fds.size(), 250);
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(lfd, nullptr, nullptr);
+            if (fd >= 0)
+                clients[fd] = std::make_unique<LineSocket>(fd);
         }
-        else {
-            // render a >= 3-ary operator, or operator without infix notation.
-            os << op->name << "(";
-            bool first = true;
-            for (auto arg : args)
-            {
-                if (!first) os << ",";
-                os << arg;
-                first = false;
+        for (int k = 1 ; k < fds.size() ; k++) {
+            if (!fds[k].revents)
+                continue;
+            int fd = fds[k].fd;
+            auto& sock = *clients[fd];
+            bool ok = sock.receive();
+            std::string line;
+            while (ok && sock.getline(line))
+                ok = handle(fd, sock, line);
+            if (!ok) {
+                // a worker which goes away loses its leases
+                for (auto id : leasesof[fd])
+                    release(id);
+                leasesof.erase(fd);
+                clients.erase(fd);
             }
-            os << ")";
+        }
+        for (auto& c : chunks)
+            if (c.state == LEASED && c.expires < now())
+                release(c.lease);
+        if (started && tick.elapsed() > 10e6) {
+            tick.lap();
+            std::cerr << "coordinator: " << ndone << " of " << chunks.size() << " ranges done, "
+                      << clients.size() << " workers, " << reassigned << " reassigned\n";
         }
     }
-    // a binary operator
-    static auto make(Node::ptr l, Node::ptr r)
-    {
-        return std::make_shared<Expr>(l, r);
+    // tell the waiting workers
+    for (auto& [fd, sock] : clients) {
+        std::string line;
+        while (sock->getline(line))
+            handle(fd, *sock, line);
     }
+    close(lfd);
+    std::cerr << "coordinator: " << chunks.size() << " ranges done, " << nhits << " hits, " << reassigned << " ranges reassigned, "
+              << formatduration(now()) << "\n";
+    return 0;
+}
 
-    // a unary operator
-    static auto make(Node::ptr l)
-    {
-        return std::make_shared<Expr>(l);
-    }
-};
-
-// generate all possible binary tree shapes with n leaves.
-void enumtrees(int nleaves, std::function<void(Node::ptr)> cb)
+// run as a worker for the coordinator at `address`
+int worker(const SearchConfig& cfg, const std::string& address)
 {
-    if (nleaves<1)
-        return;
-    if (nleaves==1) {
-        cb(Value::make());
-        return;
+    std::string host, port;
+    if (!parseaddress(address, host, port)) {
+        std::cerr << "invalid address: " << address << "\n";
+        return 1;
     }
-
-    for (int i=1 ; i<nleaves ; i++)
-    {
-        enumtrees(nleaves-i, [&](auto t) {
-                enumtrees(i, [&](auto s) {
-                        cb(Expr::make(t, s));
-                        });
-                });
+    auto engine = makeengine(cfg);
+    engine->prepare(cfg.nthreads);
+    engine->maketasks(cfg.tasksize);
+
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &ai) != 0) {
+        std::cerr << "cannot resolve " << address << "\n";
+        return 1;
     }
-}
-
-/*
-unary ops:
-    insert-in-tree at position
-
-tree-position:  use number to make l/r descision at each node,
-    then insert at that position
-    root -> unary -> node
-
- */
-template<typename P>
-struct generator {
-    P cur;
-    P end;
-    generator(P first, P last)
-        : cur(first), end(last)
-    {
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0 || connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        perror("connect");
+        freeaddrinfo(ai);
+        return 1;
     }
-    auto next()
-    {
-        if (cur==end)
-            throw std::runtime_error("end of iteration");
-        return *cur++;
+    freeaddrinfo(ai);
+    LineSocket sock(fd);
+
+    std::string line;
+    sock.send("HELLO " + workloadkey(cfg) + " " + std::to_string(engine->tasks.size()) + "\n");
+    if (!sock.readline(line) || line.compare(0, 3, "OK ") != 0) {
+        std::cerr << "coordinator: " << line << "\n";
+        return 1;
     }
-};
-
-template<typename V>
-auto iter(const V& v)
-{
-    return generator<typename V::const_iterator>(v.cbegin(), v.cend());
-}
-
-// sets leaf nodes in the tree `t` with values from the generator `g`
-template<typename GEN>
-void setvalues(Node::ptr t, GEN &g)
-{
-    auto v = std::dynamic_pointer_cast<Value>(t);
-    if (v) {
-        v->value = g.next();
-        return;
-    }
-    auto e =  std::dynamic_pointer_cast<Expr>(t);
-    if (e) {
-        for (auto a : e->args)
-            setvalues(a, g);
+    double leasetime = strtod(line.c_str()+3, 0);
+
+    uint64_t ranges = 0, hits = 0;
+    while (sock.send("LEASE\n") && sock.readline(line)) {
+        std::istringstream is(line);
+        std::string cmd;
+        is >> cmd;
+        if (cmd == "DONE")
+            break;
+        if (cmd == "WAIT") {
+            double seconds = 1;
+            is >> seconds;
+            std::this_thread::sleep_for(std::chrono::milliseconds(int(seconds*1000)));
+            continue;
+        }
+        if (cmd != "RANGE") {
+            std::cerr << "unexpected reply: " << line << "\n";
+            return 1;
+        }
+        uint64_t id;
+        size_t first, last;
+        is >> id >> first >> last;
+        std::vector<size_t> order;
+        for (size_t k = first ; k < last ; k++)
+            order.push_back(k);
+
+        std::atomic<bool> lost = false;
+        SearchHooks hooks;
+        hooks.cancel = &lost;
+        std::string prefix = "HIT " + std::to_string(id) + " ";
+        hooks.onhit = [&](T value, const Node::ptr& expr) {
+            std::ostringstream os;
+            os << prefix << value << '=' << expr << '\n';
+            if (!sock.send(os.str()))
+                lost = true;
+        };
+        hooks.progressinterval = leasetime / 3;
+        hooks.onprogress = [&](uint64_t, uint64_t, uint64_t, uint64_t, double) {
+            if (!sock.send("RENEW " + std::to_string(id) + "\n"))
+                lost = true;
+        };
+        auto stats = runsearch(*engine, cfg.nthreads, nullptr, order, 0, &hooks);
+        if (lost) {
+            std::cerr << "lost the connection to the coordinator\n";
+            return 1;
+        }
+        if (!sock.send("COMPLETE " + std::to_string(id) + "\n") || !sock.readline(line))
+            break;
+        if (line == "EXPIRED")
+            std::cerr << "lease " << id << " expired, the range was given to another worker\n";
+        else {
+            ranges++;
+            hits += stats.hits;
+        }
     }
+    std::cerr << "worker: " << ranges << " ranges, " << hits << " hits\n";
+    return 0;
 }
+#endif
 
-// sets expression nodes in the tree `t` with binary operations from the generator `g`
-template<typename GEN>
-void setops(Node::ptr t, GEN &g)
+void usage()
 {
-    auto e =  std::dynamic_pointer_cast<Expr>(t);
-    if (e) {
-        if (e->args.size()==2)
-            e->op = g.next();
-        for (auto a : e->args)
-            setops(a, g);
-    }
+    std::cout << "Usage: findexpr [-r] [-d DIGIT] [-n N] -[t TARGET] [-o OPS] [-w OPS] [-e ENGINE] [-L LEN] [-M MB] [-j N] [--plan] [--autotune]\n";
+    std::cout << "     -r     : use descending ( reverse ) order of numbers\n";
+    std::cout << "     -d D, -n N : use N times the digit D, instead of 1..9\n";
+    std::cout << "     -v NUMS : comma separated list of numbers, instead of 1..9. Can be repeated to search several\n";
+    std::cout << "              sequences of the same length at once, evaluated side by side in SIMD lanes\n";
+    std::cout << "     --permute : search all distinct orderings of the numbers\n";
+    std::cout << "     -t T   : report only when result is near target, can be repeated\n";
+    std::cout << "     -o OPS : comma separated list of binary operations to use, default: all\n";
+    std::cout << "     -w OPS : widen from OPS: skip all assignments using only these operations,\n";
+    std::cout << "              they were already searched in a previous run\n";
+    std::cout << "     -e ENGINE : enum   - evaluate each expression tree ( default )\n";
+    std::cout << "                 hybrid - value sets for short intervals, enumerate the rest\n";
+    std::cout << "                 dp     - value sets for all intervals, report distinct values\n";
+    std::cout << "                 auto   - use the configuration found by --autotune\n";
+    std::cout << "     -L LEN : hybrid: max interval length for the value sets, default: cost model\n";
+    std::cout << "     -M MB  : hybrid: memory budget for the cost model, default 1024\n";
+    std::cout << "     --max-memory MB : hard memory limit, value sets which do not fit are not built\n";
+    std::cout << "     --plan : print the size of the search space and estimate memory use and runtime\n";
+    std::cout << "     --samples N : nr of random expressions timed for the runtime estimate, default 100000\n";
+    std::cout << "     -j N   : nr of worker threads, default: nr of cpus allowed by the affinity mask and cgroup quota\n";
+    std::cout << "     --numa : pin the workers round robin over the NUMA nodes, with node local trees and value sets,\n";
+    std::cout << "              steal work from the same node first\n";
+    std::cout << "     --ordered    : write the results in the same order for any nr of threads\n";
+    std::cout << "     --dedup      : report only one expression of each canonical form: expressions which differ\n";
+    std::cout << "                    only by the order or grouping of the terms of sums and products are duplicates\n";
+    std::cout << "     --distinct   : write only the sorted distinct values of the hits, instead of all hits\n";
+    std::cout << "     --distinct-expr : the same, with one expression for each value\n";
+    std::cout << "     --estimate   : estimate the nr of distinct values of the hits, overall and per range of integers,\n";
+    std::cout << "                    with HyperLogLog sketches, instead of printing them\n";
+    std::cout << "     --coverage N : report how many of the integers 0 .. N-1 are hits, and the lowest one which is not,\n";
+    std::cout << "                    instead of printing the hits\n";
+    std::cout << "     --sort-memory MB : --distinct: memory for sorting, beyond that sorted runs are written to --tmpdir, default 1024\n";
+    std::cout << "     --tmpdir D   : --distinct: directory for the sorted runs, default $TMPDIR or /tmp\n";
+    std::cout << "     --uring      : write the output from 8 buffers with several writes in flight, through io_uring\n";
+    std::cout << "                    when available, else write(2). Reports throughput and queue depth on stderr\n";
+    std::cout << "     --uring-depth N : --uring with N buffers\n";
+    std::cout << "     --uring-buffer KB : --uring: size of each buffer, default 1024\n";
+    std::cout << "     --pipeline   : format and write the hits on their own threads, fed through bounded queues,\n";
+    std::cout << "                    so they do not stall the evaluation\n";
+    std::cout << "     --format-threads N : --pipeline: nr of threads formatting the hits, default 1\n";
+    std::cout << "     --batch N    : --pipeline: nr of hits per batch, default 1024\n";
+    std::cout << "     --queue N    : --pipeline: nr of batches each queue holds, default 64\n";
+    std::cout << "     --tasksize N : nr of expressions per task handed to a worker, default 65536\n";
+    std::cout << "     --autotune   : find the fastest engine, set length and task size for this workload\n";
+    std::cout << "     --tunefile F : where --autotune saves its result, default findexpr.tune\n";
+    std::cout << "     --tunetime S : seconds per calibration run, default 1\n";
+    std::cout << "     --progress S : report progress, rate and ETA on stderr every S seconds\n";
+    std::cout << "     --metrics F  : rewrite file F with metrics every progress interval, default 10 sec\n";
+    std::cout << "     --profile    : report time, evaluations, nan/inf rate and hits per shape,\n";
+    std::cout << "                    and the use of each operation in results and hits, on stderr\n";
+    std::cout << "     --perf-counters : report cycles, instructions, IPC, branch and cache misses\n";
+    std::cout << "                    per worker for the evaluation phase, on stderr\n";
+    std::cout << "     --trace F    : write a chrome trace / perfetto timeline of the search to F\n";
+    std::cout << "     --memstats   : report current and peak memory use per subsystem at exit\n";
+    std::cout << "     --crosscheck N : compare the hits of the hybrid, dp and lanes engines with the enum engine\n";
+    std::cout << "                    on N random small searches using the -o operations, exit code 1 on a mismatch\n";
+    std::cout << "     --seed S     : random seed for --crosscheck, default 1\n";
+    std::cout << "     --coordinator [HOST:]PORT : hand out leases on task ranges to --worker processes,\n";
+    std::cout << "                    and write their hits to stdout\n";
+    std::cout << "     --worker [HOST:]PORT : search the ranges leased from the coordinator, with the workload\n";
+    std::cout << "                    given by the other options\n";
+    std::cout << "     --lease S    : coordinator: seconds before a lease which is not renewed is handed out again, default 30\n";
+    std::cout << "     --leasesize N : coordinator: nr of tasks per lease, default 16\n";
+    std::cout << "     --summary    : print one 'summary key=value ...' line with the totals on stderr\n";
+    std::cout << "  send SIGUSR1 for a full status report on stderr\n";
 }
 
-// generate operations given the index number `i`.
-// use i as a n-ary number, each digit choosing an operation
-// from the `ops` list.
-struct OpsGenerator {
-    std::vector<Operation*> ops;
-    int cur;
-    OpsGenerator(std::vector<Operation*> ops, int i)
-        : ops(ops), cur(i)
-    {
-    }
-    Operation* next()
-    {
-        Operation *op = ops[cur % ops.size()];
-        cur /= ops.size();
-
-        return op;
-    }
-};
-
 int main(int argc,char**argv)
 {
     std::vector<int> nums = { 1,2,3,4,5,6,7,8,9 };
     int digit = -1;
     int count = -1;
-    std::string numsspec;
-    std::optional<int> target;
+    std::vector<std::string> numsspecs;
+    bool permute = false;
+    std::string opsspec;
+    std::string oldopsspec;
+    std::vector<int> targets;
+    SearchConfig cfg;
+    if (getenv("TMPDIR"))
+        cfg.tmpdir = getenv("TMPDIR");
+    cfg.nthreads = topology().defaultthreads();
+    int threads = -1;
+    bool plan = false;
+    int nsamples = 100000;
+    bool tune = false;
+    int ncrosscheck = 0;
+    std::string coordinate;
+    std::string workeraddress;
+    double leasetime = 30;
+    size_t leasesize = 16;
+    uint64_t seed = 1;
+    std::string tunefile = "findexpr.tune";
+    double tunetime = 1;
     for (auto& arg : ArgParser(argc, argv))
        switch (arg.option())
        {
            case 'r': std::reverse(nums.begin(), nums.end()); break;
            case 'd': digit = arg.getint(); break;
            case 'n': count = arg.getint(); break;
-           case 'v': numsspec = arg.getstr(); break;
-           case 't': target = arg.getint(); break;
+           case 'v': numsspecs.push_back(arg.getstr()); break;
+           case 't': targets.push_back(arg.getint()); break;
+           case 'o': opsspec = arg.getstr(); break;
+           case 'w': oldopsspec = arg.getstr(); break;
+           case 'e': cfg.engine = arg.getstr(); break;
+           case 'L': cfg.maxlen = arg.getint(); break;
+           case 'M': cfg.membudget = arg.getuint()<<20; break;
+           case 'j': cfg.nthreads = threads = arg.getint(); break;
+           case '-': if (arg.match("--plan")) plan = true;
+                     else if (arg.match("--profile")) cfg.profile = true;
+                     else if (arg.match("--perf-counters")) cfg.perfcounters = true;
+                     else if (arg.match("--trace")) cfg.tracefile = arg.getstr();
+                     else if (arg.match("--memstats")) cfg.memstats = true;
+                     else if (arg.match("--summary")) cfg.summary = true;
+                     else if (arg.match("--ordered")) cfg.ordered = true;
+                     else if (arg.match("--numa")) cfg.numa = true;
+                     else if (arg.match("--permute")) permute = true;
+                     else if (arg.match("--pipeline")) cfg.pipeline = true;
+                     else if (arg.match("--uring")) cfg.uring = 8;
+                     else if (arg.match("--uring-depth")) cfg.uring = arg.getint();
+                     else if (arg.match("--uring-buffer")) cfg.uringbuffer = arg.getuint()<<10;
+                     else if (arg.match("--dedup")) cfg.dedup = true;
+                     else if (arg.match("--distinct")) cfg.distinct = 1;
+                     else if (arg.match("--distinct-expr")) cfg.distinct = 2;
+                     else if (arg.match("--estimate")) cfg.estimate = true;
+                     else if (arg.match("--coverage")) cfg.coverage = arg.getuint();
+                     else if (arg.match("--sort-memory")) cfg.sortmemory = arg.getuint()<<20;
+                     else if (arg.match("--tmpdir")) cfg.tmpdir = arg.getstr();
+                     else if (arg.match("--format-threads")) cfg.formatthreads = arg.getint();
+                     else if (arg.match("--batch")) cfg.batchsize = arg.getuint();
+                     else if (arg.match("--queue")) cfg.queuesize = arg.getuint();
+                     else if (arg.match("--coordinator")) coordinate = arg.getstr();
+                     else if (arg.match("--worker")) workeraddress = arg.getstr();
+                     else if (arg.match("--lease")) leasetime = strtod(arg.getstr().c_str(), 0);
+                     else if (arg.match("--leasesize")) leasesize = arg.getuint();
+                     else if (arg.match("--max-memory")) cfg.maxmemory = arg.getuint()<<20;
+                     else if (arg.match("--progress")) cfg.progress = strtod(arg.getstr().c_str(), 0);
+                     else if (arg.match("--metrics")) cfg.metricsfile = arg.getstr();
+                     else if (arg.match("--samples")) nsamples = arg.getint();
+                     else if (arg.match("--tasksize")) cfg.tasksize = arg.getuint();
+                     else if (arg.match("--autotune")) tune = true;
+                     else if (arg.match("--crosscheck")) ncrosscheck = arg.getint();
+                     else if (arg.match("--seed")) seed = arg.getuint();
+                     else if (arg.match("--tunefile")) tunefile = arg.getstr();
+                     else if (arg.match("--tunetime")) tunetime = strtod(arg.getstr().c_str(), 0);
+                     else { usage(); return 1; }
+                     break;
            default:
-                     std::cout << "Usage: findexpr [-r] [-d DIGIT] [-n N] -[t TARGET]\n";
-                     std::cout << "     -r     : use descending ( reverse ) order of numbers\n";
-                     std::cout << "     -d D, -n N : use N times the digit D, instead of 1..9\n";
-                     std::cout << "     -t T   : report only when result is near target\n";
-
+                     usage();
                      return 1;
 
        }
-    if (!numsspec.empty()) {
-        nums.clear();
-        for (auto s : stringsplitter<std::string>(numsspec, ","))
-            nums.push_back(strtol(s.c_str(), 0, 0));
+    if (!numsspecs.empty()) {
+        for (auto& spec : numsspecs) {
+            std::vector<int> seq;
+            for (auto s : stringsplitter<std::string>(spec, ","))
+                seq.push_back(strtol(s.c_str(), 0, 0));
+            if (!cfg.sequences.empty() && seq.size() != cfg.sequences[0].size()) {
+                std::cerr << "all number sequences must have the same length\n";
+                return 1;
+            }
+            cfg.sequences.push_back(seq);
+        }
+        nums = cfg.sequences[0];
     }
     else if (count > 0 && digit>0) {
         nums.clear();
         nums.resize(count, digit);
     }
+    // --permute: all distinct orderings of each sequence
+    if (permute) {
+        if (cfg.sequences.empty())
+            cfg.sequences.push_back(nums);
+        std::vector<std::vector<int>> all;
+        for (auto seq : cfg.sequences) {
+            std::sort(seq.begin(), seq.end());
+            do {
+                all.push_back(seq);
+            } while (std::next_permutation(seq.begin(), seq.end()));
+        }
+        std::sort(all.begin(), all.end());
+        all.erase(std::unique(all.begin(), all.end()), all.end());
+        cfg.sequences = all;
+        nums = all[0];
+    }
+    if (cfg.sequences.size() == 1)
+        cfg.sequences.clear();
+    // -e auto: --autotune only tries the enum engine for several sequences
+    if (!cfg.sequences.empty() && cfg.engine != "enum" && cfg.engine != "auto") {
+        std::cerr << "several number sequences can only be searched with the enum engine\n";
+        return 1;
+    }
+    if (!cfg.sequences.empty() && cfg.numa) {
+        std::cerr << "--numa is not supported with several number sequences\n";
+        return 1;
+    }
 
-    std::vector<Operation*> binops;
-    for (int i = 0 ; i<oplist.size() ; i++)
-        if (oplist[i].n==2)
-            binops.push_back(&oplist[i]);
-
-    timer t;
-
-    // enum all tree shapes, then for each tree assign all possible combinations of operations
-    // and the values from 1 - 9.
-    enumtrees(nums.size(), [&](auto expr) {
-            std::cout << "=========" << t.lap() << " usec   " << expr << std::endl;
-            for (int i = 0 ; i < intpow(binops.size(), nums.size()-1) ; i++) {
-                auto iops = OpsGenerator(binops, i);
-                auto inums = iter(nums);
-                setvalues(expr, inums);
-                setops(expr, iops);
-                double result = expr->eval();
-                if (!target || fabs(result-*target)<=0.11)
-                    std::cout << result << '=' << expr << std::endl;
-            }
-        });
+    cfg.nums = nums;
+    cfg.targets = targets;
+
+    if (!opsspec.empty()) {
+        if (!parseops(opsspec, cfg.binops))
+            return 1;
+    }
+    else {
+        for (int i = 0 ; i<oplist.size() ; i++)
+            if (oplist[i].n==2)
+                cfg.binops.push_back(&oplist[i]);
+    }
+
+    // when widening the operation set, mark the ops which were already searched.
+    std::vector<Operation*> oldops;
+    if (!oldopsspec.empty() && !parseops(oldopsspec, oldops))
+        return 1;
+    cfg.widening = !oldops.empty();
+    cfg.isold.resize(cfg.binops.size());
+    for (int j = 0 ; j<cfg.binops.size() ; j++)
+        cfg.isold[j] = std::find(oldops.begin(), oldops.end(), cfg.binops[j]) != oldops.end();
+
+    if (tune) {
+        autotune(cfg, tunefile, tunetime);
+        return 0;
+    }
+    if (ncrosscheck)
+        return crosscheck(cfg, ncrosscheck, seed) ? 1 : 0;
+#ifndef _WIN32
+    if (!coordinate.empty())
+        return coordinator(coordinate, leasetime, std::max(size_t(1), leasesize));
+#endif
+    if (cfg.engine == "auto" && !loadtuning(tunefile, cfg)) {
+        std::cerr << "no tuned configuration for this workload in " << tunefile << ", run with --autotune first\n";
+        return 1;
+    }
+    // an explicit -j wins over the tuned nr of threads
+    if (threads != -1)
+        cfg.nthreads = threads;
+    if (cfg.engine == "dp")
+        cfg.maxlen = nums.size();
+    if (cfg.engine != "enum" && cfg.engine != "hybrid" && cfg.engine != "dp") {
+        std::cerr << "unknown engine: " << cfg.engine << "\n";
+        return 1;
+    }
+    if (cfg.nthreads < 1 || cfg.tasksize < 1) {
+        std::cerr << "invalid thread count or task size\n";
+        return 1;
+    }
+    if (cfg.pipeline && (cfg.formatthreads < 1 || cfg.batchsize < 1 || cfg.queuesize < 1)) {
+        std::cerr << "invalid pipeline thread count, batch or queue size\n";
+        return 1;
+    }
+    if (cfg.uring < 0 || (cfg.uring && cfg.uringbuffer < 1)) {
+        std::cerr << "invalid io_uring depth or buffer size\n";
+        return 1;
+    }
+    if (cfg.pipeline && cfg.ordered) {
+        std::cerr << "--pipeline can not be combined with --ordered\n";
+        return 1;
+    }
+    if (plan)
+        plansearch(cfg, nsamples);
+#ifndef _WIN32
+    else if (!workeraddress.empty())
+        return worker(cfg, workeraddress);
+#endif
+    else
+        search(cfg);
 }
@@ -0,0 +1,347 @@
+/*
+
+Benchmark driver for findexpr: runs a fixed suite of workloads with each engine,
+and reports expressions/sec, wall time and peak memory as JSON.
+
+Each workload runs the findexpr binary with --summary, results go to /dev/null,
+the wall time and max rss are measured from the outside.
+expr_per_sec is the size of the search space per second of wall time, so it
+can be compared between engines, evaluated_per_sec counts the evaluations
+the engine actually did.
+
+Author: Willem Hengeveld <itsme@xs4all.nl>
+*/
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <cpputils/argparse.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#ifndef FINDEXPR_PATH
+#define FINDEXPR_PATH "./findexpr"
+#endif
+
+// a benchmark workload: the findexpr arguments, without the engine
+struct Workload {
+    std::string name;
+    std::vector<std::string> args;
+    bool full;     // only run with --full, these take minutes with the enum engine
+};
+
+std::vector<Workload> suite = {
+    { "seq6",      { "-v", "1,2,3,4,5,6" }, false },
+    { "seq7",      { "-v", "1,2,3,4,5,6,7" }, false },
+    { "seq8",      { "-v", "1,2,3,4,5,6,7,8" }, true },
+    { "digit4x6",  { "-d", "4", "-n", "6" }, false },
+    { "target7",   { "-v", "1,2,3,4,5,6,7", "-t", "1000" }, false },
+    { "target8",   { "-v", "1,2,3,4,5,6,7,8", "-t", "10958" }, true },
+};
+
+std::vector<std::string> engines = { "enum", "hybrid", "dp" };
+
+// the result of one findexpr run
+struct RunResult {
+    bool ok = false;
+    double wall = 0;               // seconds
+    long maxrss = 0;               // bytes
+    std::map<std::string, std::string> summary;   // from the 'summary' line
+
+    double get(const std::string& key) const
+    {
+        auto i = summary.find(key);
+        return i == summary.end() ? 0 : strtod(i->second.c_str(), 0);
+    }
+};
+
+// parse 'summary key=value key=value ...'
+void parsesummary(const std::string& text, std::map<std::string, std::string>& kv)
+{
+    std::istringstream is(text);
+    std::string line;
+    while (std::getline(is, line)) {
+        if (line.compare(0, 8, "summary ") != 0)
+            continue;
+        std::istringstream ls(line.substr(8));
+        std::string item;
+        while (ls >> item) {
+            auto eq = item.find('=');
+            if (eq != std::string::npos)
+                kv[item.substr(0, eq)] = item.substr(eq+1);
+        }
+    }
+}
+
+// run findexpr with `args`, stdout to /dev/null, stderr captured.
+RunResult runfindexpr(const std::string& exe, const std::vector<std::string>& args)
+{
+    RunResult r;
+    int pfd[2];
+    if (pipe(pfd) < 0) {
+        perror("pipe");
+        return r;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return r;
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 1);
+        dup2(pfd[1], 2);
+        close(pfd[0]);
+        close(pfd[1]);
+        close(devnull);
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(exe.c_str()));
+        for (auto& a : args)
+            argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(exe.c_str(), argv.data());
+        perror(exe.c_str());
+        _exit(127);
+    }
+    close(pfd[1]);
+    std::string errtext;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(pfd[0], buf, sizeof(buf))) > 0)
+        errtext.append(buf, n);
+    close(pfd[0]);
+
+    int status = 0;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        perror("wait4");
+        return r;
+    }
+    r.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    r.maxrss = ru.ru_maxrss * 1024L;
+    parsesummary(errtext, r.summary);
+    r.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && !r.summary.empty();
+    if (!r.ok)
+        std::cerr << errtext;
+    return r;
+}
+
+std::string jsonstring(const std::string& s)
+{
+    std::string q = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            q += '\\';
+        q += c;
+    }
+    return q + "\"";
+}
+
+// run a workload `repeat` times, returns the fastest run, and the max rss over all runs in `maxrss`
+RunResult runbest(const std::string& exe, const Workload& w, const std::string& engine, int nthreads, int repeat, long& maxrss)
+{
+    std::vector<std::string> args = w.args;
+    args.insert(args.end(), { "-e", engine, "--summary" });
+    if (nthreads)
+        args.insert(args.end(), { "-j", std::to_string(nthreads) });
+
+    RunResult best;
+    maxrss = 0;
+    for (int i = 0 ; i < repeat ; i++) {
+        auto r = runfindexpr(exe, args);
+        if (!r.ok)
+            return r;
+        maxrss = std::max(maxrss, r.maxrss);
+        if (!best.ok || r.wall < best.wall)
+            best = r;
+    }
+    return best;
+}
+
+// split a comma separated list of numbers
+std::vector<double> splitnumbers(const std::string& s)
+{
+    std::vector<double> v;
+    std::istringstream is(s);
+    std::string item;
+    while (std::getline(is, item, ','))
+        v.push_back(strtod(item.c_str(), 0));
+    return v;
+}
+
+// run workload `w` with 1, 2, 4, ... `maxthreads` threads, and report the speedup and
+// efficiency relative to the single thread run, the steals and the idle time per thread.
+bool scaling(const std::string& exe, const Workload& w, const std::string& engine, int maxthreads, int repeat, std::ostream& js, bool& first)
+{
+    std::vector<int> counts;
+    for (int t = 1 ; t < maxthreads ; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxthreads);
+
+    double wall1 = 0, search1 = 0;
+    char buf[256];
+    for (auto t : counts) {
+        long maxrss;
+        auto r = runbest(exe, w, engine, t, repeat, maxrss);
+        if (!r.ok) {
+            std::cerr << w.name << " " << engine << " " << t << " threads: FAILED\n";
+            return false;
+        }
+        if (t == 1) {
+            wall1 = r.wall;
+            search1 = r.get("search");
+        }
+        double speedup = wall1 / r.wall;
+        double search = r.get("search");
+        auto idle = splitnumbers(r.summary["idle"]);
+        double totalidle = 0, maxidle = 0;
+        for (auto x : idle) {
+            totalidle += x;
+            maxidle = std::max(maxidle, x);
+        }
+        // the fraction of the worker time spent waiting
+        double idlefraction = search > 0 ? totalidle / (search * t) : 0;
+
+        snprintf(buf, sizeof(buf), "%-10s %-7s %4d threads: %8.3f sec, speedup %6.2f, efficiency %5.1f%%, %6.0f steals, idle %5.1f%%, max idle %.3f sec\n",
+                w.name.c_str(), engine.c_str(), t, r.wall, speedup, 100 * speedup / t, r.get("steals"), 100 * idlefraction, maxidle);
+        std::cerr << buf;
+
+        js << (first ? "\n" : ",\n");
+        first = false;
+        js << "    { \"workload\": " << jsonstring(w.name) << ", \"engine\": " << jsonstring(engine) << ", \"threads\": " << t;
+        snprintf(buf, sizeof(buf), ", \"wall_seconds\": %.6f, \"prepare_seconds\": %.6f, \"search_seconds\": %.6f",
+                r.wall, r.get("prepare"), search);
+        js << buf;
+        snprintf(buf, sizeof(buf), ", \"speedup\": %.4f, \"efficiency\": %.4f, \"search_speedup\": %.4f",
+                speedup, speedup / t, search > 0 ? search1 / search : 0);
+        js << buf;
+        snprintf(buf, sizeof(buf), ", \"tasks\": %.0f, \"steals\": %.0f, \"idle_fraction\": %.4f, \"idle_seconds\": [",
+                r.get("tasks"), r.get("steals"), idlefraction);
+        js << buf;
+        for (int k = 0 ; k < idle.size() ; k++) {
+            snprintf(buf, sizeof(buf), "%s%.6f", k ? ", " : "", idle[k]);
+            js << buf;
+        }
+        js << "] }";
+    }
+    return true;
+}
+
+void usage()
+{
+    std::cout << "Usage: findexpr_bench [--full] [--scaling] [--repeat N] [-j N] [-w NAME] [-e ENGINE] [-o FILE] [--findexpr PATH]\n";
+    std::cout << "     --full      : also run the large workloads, these take long with the enum engine\n";
+    std::cout << "     --repeat N  : run each workload N times, the fastest run is reported, default 1\n";
+    std::cout << "     --scaling   : run with 1, 2, 4, ... N threads, report speedup, efficiency, steals and idle time,\n";
+    std::cout << "                   default: the seq7 workload with the enum and dp engines\n";
+    std::cout << "     -j N        : nr of worker threads passed to findexpr, default: findexpr's default,\n";
+    std::cout << "                   with --scaling: the max nr of threads, default: nr of cpus\n";
+    std::cout << "     -w NAME     : only run workloads with NAME in their name\n";
+    std::cout << "     -e ENGINE   : only run this engine\n";
+    std::cout << "     -o FILE     : write the json to FILE instead of stdout\n";
+    std::cout << "     --findexpr PATH : the findexpr binary, default " FINDEXPR_PATH "\n";
+}
+
+int main(int argc, char**argv)
+{
+    std::string exe = FINDEXPR_PATH;
+    std::string outfile;
+    std::string filter;
+    std::string engine;
+    bool full = false;
+    bool scale = false;
+    int repeat = 1;
+    int nthreads = 0;
+    for (auto& arg : ArgParser(argc, argv))
+        switch (arg.option())
+        {
+            case 'j': nthreads = arg.getint(); break;
+            case 'w': filter = arg.getstr(); break;
+            case 'e': engine = arg.getstr(); break;
+            case 'o': outfile = arg.getstr(); break;
+            case '-': if (arg.match("--full")) full = true;
+                      else if (arg.match("--scaling")) scale = true;
+                      else if (arg.match("--repeat")) repeat = arg.getint();
+                      else if (arg.match("--findexpr")) exe = arg.getstr();
+                      else { usage(); return 1; }
+                      break;
+            default:
+                      usage();
+                      return 1;
+        }
+
+    std::ostringstream js;
+    js << "{\n  \"findexpr\": " << jsonstring(exe) << ",\n";
+    js << "  \"threads\": " << nthreads << ",\n";
+    js << "  \"mode\": " << jsonstring(scale ? "scaling" : "suite") << ",\n";
+    js << "  \"results\": [";
+    bool first = true;
+    bool failed = false;
+    if (scale) {
+        int maxthreads = nthreads ? nthreads : std::max(1u, std::thread::hardware_concurrency());
+        if (filter.empty())
+            filter = "seq7";
+        for (auto& w : suite) {
+            if (w.name.find(filter) == std::string::npos)
+                continue;
+            for (auto& e : { "enum", "dp" })
+                if (engine.empty() || engine == e)
+                    failed |= !scaling(exe, w, e, maxthreads, repeat, js, first);
+            if (!engine.empty() && engine != "enum" && engine != "dp")
+                failed |= !scaling(exe, w, engine, maxthreads, repeat, js, first);
+        }
+    }
+    else for (auto& w : suite) {
+        if (w.full && !full)
+            continue;
+        if (!filter.empty() && w.name.find(filter) == std::string::npos)
+            continue;
+        for (auto& e : engines) {
+            if (!engine.empty() && e != engine)
+                continue;
+            long maxrss;
+            auto best = runbest(exe, w, e, nthreads, repeat, maxrss);
+            std::cerr << w.name << " " << e << ": ";
+            if (!best.ok) {
+                std::cerr << "FAILED\n";
+                failed = true;
+                continue;
+            }
+            char buf[256];
+            snprintf(buf, sizeof(buf), "%.3f sec, %.0f expr/sec, %ld MB\n", best.wall, best.get("space") / best.wall, maxrss >> 20);
+            std::cerr << buf;
+
+            js << (first ? "\n" : ",\n");
+            first = false;
+            js << "    { \"workload\": " << jsonstring(w.name) << ", \"engine\": " << jsonstring(e);
+            js << ", \"args\": " << jsonstring([&]{ std::string s; for (auto& a : w.args) s += (s.empty() ? "" : " ") + a; return s; }());
+            snprintf(buf, sizeof(buf), ", \"wall_seconds\": %.6f, \"prepare_seconds\": %.6f, \"search_seconds\": %.6f",
+                    best.wall, best.get("prepare"), best.get("search"));
+            js << buf;
+            snprintf(buf, sizeof(buf), ", \"expressions\": %.0f, \"expr_per_sec\": %.1f, \"evaluated\": %.0f, \"evaluated_per_sec\": %.1f",
+                    best.get("space"), best.get("space") / best.wall, best.get("evaluated"), best.get("evaluated") / best.wall);
+            js << buf;
+            snprintf(buf, sizeof(buf), ", \"hits\": %.0f, \"peak_rss_bytes\": %ld, \"peak_accounted_bytes\": %.0f }",
+                    best.get("hits"), maxrss, best.get("peakmem"));
+            js << buf;
+        }
+    }
+    js << "\n  ]\n}\n";
+
+    if (outfile.empty())
+        std::cout << js.str();
+    else
+        std::ofstream(outfile) << js.str();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+/*
+
+Microbenchmarks for the findexpr building blocks: the operation kernels and the
+expression evaluators, reported in ns per operation.
+
+The operands are drawn from the value sets of the intervals of 1..7 of up to
+3 numbers, this is the distribution the operations see in a real search,
+including the huge, tiny, inf and nan values.
+
+Author: Willem Hengeveld <itsme@xs4all.nl>
+*/
+
+#include <cpputils/argparse.h>
+#include "exprcore.h"
+
+using namespace findexpr;
+
+// prevent the compiler from optimizing away the results
+volatile T benchsink;
+
+// run `fn` repeatedly for at least `mintime` seconds, return ns per call of fn divided by `percall`
+template<typename FN>
+double measure(FN fn, double percall, double mintime)
+{
+    fn();    // warm up
+    uint64_t calls = 0;
+    timer t;
+    uint64_t usec;
+    do {
+        for (int i = 0 ; i < 16 ; i++)
+            fn();
+        calls += 16;
+        usec = t.elapsed();
+    } while (usec < mintime*1e6);
+    return usec * 1000.0 / calls / percall;
+}
+
+// operand pairs from the value sets of short intervals
+void makeoperands(std::vector<T>& a, std::vector<T>& b, size_t count)
+{
+    SearchConfig cfg;
+    cfg.nums = { 1,2,3,4,5,6,7 };
+    for (auto& op : oplist)
+        if (op.n == 2)
+            cfg.binops.push_back(&op);
+    cfg.isold.resize(cfg.binops.size());
+    ValueSets vs(cfg.nums.size());
+    buildsets(vs, cfg, 3, cfg.membudget, 1);
+
+    std::vector<T> pool;
+    for (auto& s : vs.sets)
+        for (auto& e : s)
+            pool.push_back(e.value);
+
+    std::mt19937_64 rng(1234);
+    std::uniform_int_distribution<size_t> pick(0, pool.size()-1);
+    for (size_t i = 0 ; i < count ; i++) {
+        a.push_back(pool[pick(rng)]);
+        b.push_back(pool[pick(rng)]);
+    }
+}
+
+void usage()
+{
+    std::cout << "Usage: findexpr_microbench [-n N] [--mintime S]\n";
+    std::cout << "     -n N        : nr of numbers in the evaluator shapes, default 6\n";
+    std::cout << "     --mintime S : minimum time per measurement, default 0.2 sec\n";
+}
+
+int main(int argc, char**argv)
+{
+    int n = 6;
+    double mintime = 0.2;
+    for (auto& arg : ArgParser(argc, argv))
+        switch (arg.option())
+        {
+            case 'n': n = arg.getint(); break;
+            case '-': if (arg.match("--mintime")) mintime = strtod(arg.getstr().c_str(), 0);
+                      else { usage(); return 1; }
+                      break;
+            default:
+                      usage();
+                      return 1;
+        }
+    if (n < 2 || n > 12) {
+        std::cerr << "n must be between 2 and 12\n";
+        return 1;
+    }
+
+    const size_t batch = 1024;
+    std::vector<T> a, b, r(batch);
+    makeoperands(a, b, batch);
+
+    // the kernels: through the generic argument vector interface, the scalar
+    // function pointer, and the function pointer applied to a batch of operands.
+    printf("%-10s %12s %12s %12s\n", "kernel", "fn ns/op", "bin ns/op", "batch ns/op");
+    for (auto& op : oplist) {
+        if (op.n != 2)
+            continue;
+        size_t i = 0;
+        double tfn = measure([&]() {
+                benchsink = op.fn({ a[i], b[i] });
+                i = (i+1) % batch;
+                }, 1, mintime);
+        double tbin = measure([&]() {
+                benchsink = op.bin(a[i], b[i]);
+                i = (i+1) % batch;
+                }, 1, mintime);
+        double tbatch = measure([&]() {
+                auto bin = op.bin;
+                for (size_t k = 0 ; k < batch ; k++)
+                    r[k] = bin(a[k], b[k]);
+                benchsink = r[batch-1];
+                }, batch, mintime);
+        printf("%-10s %12.2f %12.2f %12.2f\n", op.name.c_str(), tfn, tbin, tbatch);
+    }
+
+    // the evaluators, on all shapes with n numbers, with random operation assignments
+    SearchConfig cfg;
+    for (int k = 1 ; k <= n ; k++)
+        cfg.nums.push_back(k);
+    for (auto& op : oplist)
+        if (op.n == 2)
+            cfg.binops.push_back(&op);
+    cfg.isold.resize(cfg.binops.size());
+    int nops = n-1;
+    const int nassign = 64;
+    std::mt19937_64 rng(5678);
+    std::uniform_int_distribution<uint64_t> pick(0, upow(cfg.binops.size(), nops)-1);
+    std::vector<uint64_t> assign;
+    for (int k = 0 ; k < nassign ; k++)
+        assign.push_back(pick(rng));
+
+    std::vector<Node::ptr> shapes;
+    for (auto expr : treeshapes(n))
+        shapes.push_back(expr);
+    std::vector<Skeleton> skeletons;
+    for (auto& sk : skeletonshapes(0, n, 1))
+        skeletons.push_back(sk);
+
+    std::vector<T> leafvalues(cfg.nums.begin(), cfg.nums.end());
+    std::vector<std::vector<int>> opcodes;
+    for (auto i : assign) {
+        std::vector<int> ops;
+        for (int p = 0 ; p < nops ; p++) {
+            ops.push_back(i % cfg.binops.size());
+            i /= cfg.binops.size();
+        }
+        opcodes.push_back(ops);
+    }
+    std::vector<std::vector<Operation*>> assignops;
+    for (auto& ops : opcodes) {
+        std::vector<Operation*> a;
+        for (auto o : ops)
+            a.push_back(cfg.binops[o]);
+        assignops.push_back(a);
+    }
+    // the lanes engine: LANES sequences, rotations of the numbers, stored per leaf for all lanes
+    std::vector<LaneKernel> kernels;
+    for (auto op : cfg.binops)
+        kernels.push_back(findlanekernel(op));
+    std::vector<T> lanevalues(n * LANES);
+    for (int l = 0 ; l < LANES ; l++)
+        for (int k = 0 ; k < n ; k++)
+            lanevalues[k*LANES + l] = cfg.nums[(k + l) % n];
+
+    double evals = shapes.size() * nassign;
+    printf("\n%zu shapes with %d numbers, %d operation assignments each\n", shapes.size(), n, nassign);
+    printf("%-24s %12s %12s\n", "evaluator", "ns/expr", "ns/op");
+
+    // the tree, with the operations already assigned: only Expr::eval
+    double ttree = measure([&]() {
+            for (auto& expr : shapes) {
+                auto iops = opsgenerator(cfg.binops, assign[0]);
+                auto inums = iter(cfg.nums);
+                setvalues(expr, inums);
+                setops(expr, iops);
+                for (int k = 0 ; k < nassign ; k++)
+                    benchsink = expr->eval();
+            }
+            }, evals, mintime);
+    printf("%-24s %12.1f %12.2f\n", "tree Expr::eval", ttree, ttree / nops);
+
+    // the tree, as used by the enum engine: assign the values once, then the operations for each eval
+    double tenum = measure([&]() {
+            for (auto& expr : shapes) {
+                auto inums = iter(cfg.nums);
+                setvalues(expr, inums);
+                for (auto& ops : assignops) {
+                    auto iops = iter(ops);
+                    setops(expr, iops);
+                    benchsink = expr->eval();
+                }
+            }
+            }, evals, mintime);
+    printf("%-24s %12.1f %12.2f\n", "tree with setops", tenum, tenum / nops);
+
+    // the postfix program used by the hybrid engine
+    double tpostfix = measure([&]() {
+            for (auto& sk : skeletons)
+                for (auto& ops : opcodes)
+                    benchsink = evalskeleton(sk, cfg.binops, leafvalues.data(), ops.data());
+            }, evals, mintime);
+    printf("%-24s %12.1f %12.2f\n", "postfix evalskeleton", tpostfix, tpostfix / nops);
+
+    // the postfix program for LANES sequences at once, used by the lanes engine
+    alignas(64) T results[LANES];
+    double tlanes = measure([&]() {
+            for (auto& sk : skeletons)
+                for (auto& ops : opcodes) {
+                    evallanes(sk, cfg.binops, kernels, lanevalues.data(), ops.data(), results);
+                    benchsink = results[0];
+                }
+            }, evals * LANES, mintime);
+    printf("%-24s %12.1f %12.2f\n", "lanes evallanes", tlanes, tlanes / nops);
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+/*
+
+findexpr_tests: checks of the data structures used by the search, and of the
+exprsearch library api. Run with `ctest`, or directly, the exit code is 1 on a failure.
+
+Author: Willem Hengeveld <itsme@xs4all.nl>
+*/
+#include <set>
+#include <filesystem>
+#include "exprcore.h"
+#include "exprsearch.h"
+
+using namespace findexpr;
+
+int nchecks = 0, nfailed = 0;
+
+void check(bool ok, const char *what, int line)
+{
+    nchecks++;
+    if (!ok) {
+        nfailed++;
+        std::cout << "line " << line << ": check failed: " << what << "\n";
+    }
+}
+#define CHECK(x) check((x), #x, __LINE__)
+
+// the output written to std::cout by `fn`
+std::string captured(std::function<void()> fn)
+{
+    std::ostringstream os;
+    auto old = std::cout.rdbuf(os.rdbuf());
+    fn();
+    std::cout.rdbuf(old);
+    return os.str();
+}
+
+// the bitmap holds exactly the integers of `ref`
+bool same(const IntBitmap& bm, const std::set<uint32_t>& ref, uint32_t limit)
+{
+    if (bm.count() != ref.size())
+        return false;
+    for (uint32_t v = 0 ; v < limit ; v++)
+        if (bm.contains(v) != (ref.count(v) != 0))
+            return false;
+    return true;
+}
+
+void testbitmap()
+{
+    // a: an array block and a bitmap block, b: a bitmap block overlapping a's array block
+    IntBitmap a, b;
+    std::set<uint32_t> ra, rb;
+    for (uint32_t v = 0 ; v < 10000 ; v += 3) {
+        a.add(v);
+        ra.insert(v);
+    }
+    a.addrange(0x10000, 0x10000 + 10000);
+    for (uint32_t v = 0x10000 ; v < 0x10000 + 10000 ; v++)
+        ra.insert(v);
+    for (uint32_t v = 0 ; v < 20000 ; v += 2) {
+        b.add(v);
+        rb.insert(v);
+    }
+    uint32_t limit = 0x30000;
+    CHECK(a.blocks[0].dense.empty());
+    CHECK(!a.blocks[1].dense.empty());
+    CHECK(!b.blocks[0].dense.empty());
+    CHECK(same(a, ra, limit));
+    CHECK(same(b, rb, limit));
+
+    IntBitmap u = a;
+    u.unite(b);
+    std::set<uint32_t> ru = ra;
+    ru.insert(rb.begin(), rb.end());
+    CHECK(same(u, ru, limit));
+
+    // the intersection of an array and a bitmap block is small enough for an array again
+    IntBitmap i = b;
+    i.intersect(a);
+    std::set<uint32_t> ri;
+    std::set_intersection(ra.begin(), ra.end(), rb.begin(), rb.end(), std::inserter(ri, ri.end()));
+    CHECK(same(i, ri, limit));
+    CHECK(i.blocks[0].dense.empty());
+    CHECK(i.blocks.count(1) == 0);
+
+    // intersecting two bitmaps
+    IntBitmap d = u;
+    d.intersect(b);
+    CHECK(same(d, rb, limit));
+
+    CHECK(a.firstmissing(0) == 1);
+    CHECK(a.firstmissing(0x10000) == 0x10000 + 10000);
+    IntBitmap full;
+    full.addrange(0, 0x20000);
+    CHECK(full.count() == 0x20000);
+    CHECK(full.firstmissing(5) == 0x20000);
+}
+
+void testhyperloglog()
+{
+    HyperLogLog a(12), b(12);
+    std::mt19937_64 rng(1);
+    for (int k = 0 ; k < 50000 ; k++)
+        a.add(rng());
+    for (int k = 0 ; k < 50000 ; k++)
+        b.add(rng());
+    // 3 standard errors
+    auto near = [](double e, double n, double err) { return std::fabs(e - n) <= 3 * err * n; };
+    CHECK(near(a.estimate(), 50000, a.error()));
+    HyperLogLog m = a;
+    m.merge(b);
+    CHECK(near(m.estimate(), 100000, m.error()));
+    // merging the same values again changes nothing
+    double before = m.estimate();
+    m.merge(a);
+    CHECK(m.estimate() == before);
+
+    HyperLogLog small(12);
+    for (int k = 0 ; k < 100 ; k++)
+        small.add(rng());
+    CHECK(near(small.estimate(), 100, 0.02));
+}
+
+Node::ptr num(int v)
+{
+    auto n = Value::make();
+    n->value = v;
+    return n;
+}
+Node::ptr bin(const char *op, Node::ptr l, Node::ptr r)
+{
+    auto e = Expr::make(l, r);
+    e->op = findbinop(op);
+    return e;
+}
+
+void testcanonical()
+{
+    auto c = [](Node::ptr t) { return canonical(t); };
+    CHECK(c(bin("+", num(1), bin("+", num(2), num(3)))) == c(bin("+", bin("+", num(1), num(2)), num(3))));
+    CHECK(c(bin("+", num(1), bin("+", num(2), num(3)))) == c(bin("+", bin("+", num(3), num(2)), num(1))));
+    CHECK(c(bin("-", num(1), bin("-", num(2), num(3)))) == c(bin("-", bin("+", num(1), num(3)), num(2))));
+    CHECK(c(bin("*", num(2), bin("+", num(3), num(4)))) == c(bin("*", bin("+", num(4), num(3)), num(2))));
+    CHECK(c(bin("/", num(2), bin("/", num(3), num(4)))) == c(bin("/", bin("*", num(4), num(2)), num(3))));
+    CHECK(c(bin("-", num(1), num(2))) != c(bin("-", num(2), num(1))));
+    CHECK(c(bin("/", num(2), num(3))) != c(bin("/", num(3), num(2))));
+    CHECK(c(bin("^", num(2), num(3))) != c(bin("^", num(3), num(2))));
+    CHECK(c(bin("+", num(1), bin("*", num(2), num(3)))) != c(bin("*", bin("+", num(1), num(2)), num(3))));
+}
+
+void testhashset()
+{
+    HashSet set;
+    CHECK(set.insert(12345));
+    CHECK(!set.insert(12345));
+    CHECK(set.size() == 1);
+
+    // from several threads, with overlapping ranges: each value is new exactly once
+    std::atomic<uint64_t> inserted = 0;
+    parallel(4, [&](int t) {
+        for (uint64_t v = 0 ; v < 20000 ; v++)
+            if (set.insert(hashstring(std::to_string(t*10000 + v))))
+                inserted++;
+    });
+    CHECK(inserted == 50000);
+    CHECK(set.size() == 50001);
+}
+
+void testreorder()
+{
+    Output out;
+    std::string text = captured([&]() {
+        ReorderBuffer rb(&out, 4, [](size_t pos) { return "|" + std::to_string(pos) + "\n"; });
+        rb.put(2, "c\n", {});
+        rb.put(0, "a\n", {});
+        rb.put(3, "", {});
+        rb.put(1, "b\n", {});
+    });
+    CHECK(text == "a\n|0\nb\n|1\nc\n|2\n|3\n");
+
+    // --dedup: the copy in the first task is kept, whichever task is put first
+    HashSet dedup;
+    text = captured([&]() {
+        ReorderBuffer rb(&out, 4, [](size_t) { return std::string("-\n"); });
+        rb.dedup = &dedup;
+        rb.put(1, "x\nz\n", { { 1, 0, 2 }, { 3, 2, 4 } });
+        rb.put(0, "x\ny\n", { { 1, 0, 2 }, { 2, 2, 4 } });
+        CHECK(rb.duplicates == 1);
+    });
+    CHECK(text == "x\ny\n-\nz\n-\n");
+}
+
+void testdistinct()
+{
+    // the smallest buffers, 1 MB, with more distinct values than fit: most are spilled
+    // to run files and merged back. Of equal values the first expression is kept.
+    std::string tmpdir = std::filesystem::temp_directory_path().string();
+    DistinctValues dv(2, true, 1, tmpdir);
+    for (int k = 0 ; k < 100000 ; k++) {
+        int v = k % 50000;
+        dv.add(0, v, bin("+", num(v), num(0)));
+        dv.add(1, v, num(v));
+    }
+    // -0 is printed as 0, also when its expression is the one kept
+    dv.add(0, -0.0, bin("*", num(-1), num(0)));
+    dv.add(1, NAN, num(0));
+    dv.finish(0);
+    dv.finish(1);
+    CHECK(dv.spilled > 0);
+    Output out;
+    uint64_t count = 0;
+    std::string text = captured([&]() { count = dv.write(out); });
+    CHECK(count == 50000);
+    std::string expected = "0=-1*0\n";
+    for (int v = 1 ; v < 50000 ; v++)
+        expected += std::to_string(v) + "=" + std::to_string(v) + "\n";
+    CHECK(text == expected);
+}
+
+void testexprsearch()
+{
+    SearchOptions opts;
+    opts.numbers = { 1, 2, 3, 4 };
+    opts.operations = { "+", "*" };
+    opts.targets = { 10 };
+    opts.threads = 2;
+    opts.tasksize = 7;
+
+    // the callback and the pull interface find the same results
+    std::multiset<std::string> called, pulled;
+    SearchProgress last;
+    {
+        ExprSearch search(opts);
+        search.onprogress([&](const SearchProgress& p) { last = p; }, 0.01);
+        search.run([&](const SearchResult& r) { called.insert(r.expression); return true; });
+    }
+    {
+        ExprSearch search(opts);
+        for (auto& r : search)
+            pulled.insert(r.expression);
+    }
+    CHECK(!called.empty());
+    CHECK(called == pulled);
+    // all 5 tree shapes print without brackets
+    CHECK(called.count("1+2+3+4") == 5);
+    CHECK(last.done == last.total && last.hits == called.size());
+
+    // returning false stops the results
+    opts.targets.clear();
+    int n = 0;
+    {
+        ExprSearch search(opts);
+        search.run([&](const SearchResult&) { return ++n < 5; });
+        CHECK(search.cancelled());
+    }
+    CHECK(n == 5);
+
+    // leaving the loop early cancels the background search
+    n = 0;
+    {
+        opts.queuesize = 2;
+        ExprSearch search(opts);
+        for (auto& r : search) {
+            (void)r;
+            if (++n == 3)
+                break;
+        }
+        search.cancel();
+        CHECK(!search.next());
+    }
+    CHECK(n == 3);
+
+    bool threw = false;
+    try {
+        opts.operations = { "%" };
+        ExprSearch search(opts);
+    }
+    catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+int main()
+{
+    testbitmap();
+    testhyperloglog();
+    testcanonical();
+    testhashset();
+    testreorder();
+    testdistinct();
+    testexprsearch();
+    std::cout << nchecks << " checks, " << nfailed << " failed\n";
+    return nfailed ? 1 : 0;
+}